@@ -0,0 +1,135 @@
+/*
+*  This Source Code Form is subject to the terms of the Mozilla Public
+*  License, v. 2.0. If a copy of the MPL was not distributed with this
+*  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#include "addr-cache.h"
+#include "collections.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <threads.h>
+#include <netinet/in.h>
+
+struct addrCacheEntry
+{
+    uint64_t expires; //Monotonic time in seconds
+    bool negative;
+    addrList addrs;
+};
+
+//Host ids are handed out in sequence, so they spread evenly without hashing.
+//The low bits pick the shard, so the slot is picked with the bits above them.
+#define SHARD_INDEX(host) ((host) & (ADDR_CACHE_SHARDS - 1))
+#define SLOT_HASH(host) ((host) / ADDR_CACHE_SHARDS)
+#define HOST_EQUAL(a, b) ((a) == (b))
+
+//Entries live in the map's slots, so adding one doesn't allocate unless the shard has to grow
+CREATE_HASH_MAP_TYPE(addrCacheMap, acm, hostId, struct addrCacheEntry, SLOT_HASH, HOST_EQUAL)
+
+struct addrCacheShard
+{
+    mtx_t mutex;
+    addrCacheMap entries;
+};
+
+static struct
+{
+    once_flag initFlag;
+    struct addrCacheShard shards[ADDR_CACHE_SHARDS];
+} addrCache = { .initFlag = ONCE_FLAG_INIT };
+
+static void init_addr_cache()
+{
+    for (size_t i = 0; i < ADDR_CACHE_SHARDS; i++)
+    {
+        struct addrCacheShard *shard = &addrCache.shards[i];
+        mtx_init(&shard->mutex, mtx_plain);
+        shard->entries = acm_new(0); //Slots hold whole address lists, so they aren't allocated until a host needs one
+    }
+}
+
+static uint64_t monotonic_seconds()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec;
+}
+
+static struct addrCacheShard *get_shard(hostId host)
+{
+    call_once(&addrCache.initFlag, init_addr_cache);
+    return &addrCache.shards[SHARD_INDEX(host)];
+}
+
+static void shard_insert(hostId host, const addrList *addrs, bool negative, unsigned int ttlSeconds)
+{
+    struct addrCacheShard *shard = get_shard(host);
+    struct addrCacheEntry entry = { .expires = monotonic_seconds() + ttlSeconds, .negative = negative };
+    if (addrs != nullptr) entry.addrs = *addrs;
+
+    mtx_lock(&shard->mutex);
+    acm_put(&shard->entries, host, entry);
+    mtx_unlock(&shard->mutex);
+}
+
+addrCacheStatus addr_cache_get(hostId host, addrList *output)
+{
+    struct addrCacheShard *shard = get_shard(host);
+    addrCacheStatus status = ADDR_CACHE_MISS;
+
+    mtx_lock(&shard->mutex);
+    struct addrCacheEntry *entry = acm_get(&shard->entries, host);
+    if (entry != nullptr && entry->expires <= monotonic_seconds()) acm_remove(&shard->entries, host, nullptr);
+    else if (entry != nullptr && entry->negative) status = ADDR_CACHE_NEGATIVE;
+    else if (entry != nullptr)
+    {
+        status = ADDR_CACHE_HIT;
+        *output = entry->addrs;
+    }
+    mtx_unlock(&shard->mutex);
+
+    return status;
+}
+
+void addr_cache_add(hostId host, const addrList *addrs, unsigned int ttlSeconds)
+{
+    shard_insert(host, addrs, false, ttlSeconds);
+}
+
+void addr_cache_add_negative(hostId host, unsigned int ttlSeconds)
+{
+    shard_insert(host, nullptr, true, ttlSeconds);
+}
+
+void addr_cache_set_preferred_family(hostId host, int family)
+{
+    struct addrCacheShard *shard = get_shard(host);
+    mtx_lock(&shard->mutex);
+    struct addrCacheEntry *entry = acm_get(&shard->entries, host);
+    if (entry != nullptr && !entry->negative) entry->addrs.preferredFamily = family;
+    mtx_unlock(&shard->mutex);
+}
+
+addrList addr_list_from_addrinfo(const struct addrinfo *info)
+{
+    addrList output = { 0 };
+    for (; info != nullptr && output.count < ADDR_CACHE_MAX_ADDRS; info = info->ai_next)
+    {
+        if (info->ai_family != AF_INET && info->ai_family != AF_INET6) continue;
+        resolvedAddr *addr = &output.addrs[output.count++];
+        memcpy(&addr->addr, info->ai_addr, info->ai_addrlen);
+        addr->addrLen = info->ai_addrlen;
+    }
+    return output;
+}
+
+void resolved_addr_set_port(resolvedAddr *addr, int port)
+{
+    if (addr->addr.ss_family == AF_INET6)
+        ((struct sockaddr_in6 *)&addr->addr)->sin6_port = htons((uint16_t)port);
+    else
+        ((struct sockaddr_in *)&addr->addr)->sin_port = htons((uint16_t)port);
+}
\ No newline at end of file
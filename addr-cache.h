@@ -0,0 +1,82 @@
+/*
+*  This Source Code Form is subject to the terms of the Mozilla Public
+*  License, v. 2.0. If a copy of the MPL was not distributed with this
+*  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#ifndef GOPHERBROWSER_ADDR_CACHE_H
+#define GOPHERBROWSER_ADDR_CACHE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include "host-intern.h"
+
+//Number of independently locked shards. Must be a power of two.
+#define ADDR_CACHE_SHARDS 16
+//Maximum number of addresses remembered for a single host
+#define ADDR_CACHE_MAX_ADDRS 8
+//getaddrinfo doesn't tell us the record's real TTL, so successful lookups are kept for this long(in seconds)
+#define ADDR_CACHE_DEFAULT_TTL 300
+//Failed lookups are remembered for this long(in seconds) so a dead host doesn't hit the resolver every time
+#define ADDR_CACHE_NEGATIVE_TTL 15
+
+/*
+ A single resolved address, either IPv4 or IPv6.
+ */
+typedef struct resolvedAddr
+{
+    struct sockaddr_storage addr;
+    socklen_t addrLen;
+} resolvedAddr;
+
+/*
+ All of the addresses known for a host, in the order the resolver returned them.
+ */
+typedef struct addrList
+{
+    size_t count;
+    resolvedAddr addrs[ADDR_CACHE_MAX_ADDRS];
+    int preferredFamily; //Family of the address we last managed to connect to, or AF_UNSPEC if we haven't yet
+} addrList;
+
+typedef enum addrCacheStatus
+{
+    ADDR_CACHE_MISS = 0,
+    ADDR_CACHE_HIT,
+    ADDR_CACHE_NEGATIVE //The host is known not to resolve
+} addrCacheStatus;
+
+/*
+ Looks up the host in the cache, filling in output on a hit. Expired entries are treated as misses.
+ */
+addrCacheStatus addr_cache_get(hostId host, addrList *output);
+
+/*
+ Stores the addresses for a host, replacing any existing entry. The entry expires after ttlSeconds.
+ */
+void addr_cache_add(hostId host, const addrList *addrs, unsigned int ttlSeconds);
+
+/*
+ Records that the host failed to resolve. The entry expires after ttlSeconds.
+ */
+void addr_cache_add_negative(hostId host, unsigned int ttlSeconds);
+
+/*
+ Remembers which address family we managed to connect to the host over, so that later connections try it first.
+ Does nothing if the host isn't cached.
+ */
+void addr_cache_set_preferred_family(hostId host, int family);
+
+/*
+ Fills an addrList from the results of getaddrinfo, skipping anything that isn't IPv4 or IPv6.
+ */
+addrList addr_list_from_addrinfo(const struct addrinfo *info);
+
+/*
+ Sets the port of the address, regardless of its family.
+ */
+void resolved_addr_set_port(resolvedAddr *addr, int port);
+
+#endif //GOPHERBROWSER_ADDR_CACHE_H
\ No newline at end of file
@@ -0,0 +1,262 @@
+/*
+*  This Source Code Form is subject to the terms of the Mozilla Public
+*  License, v. 2.0. If a copy of the MPL was not distributed with this
+*  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#include "buffer-pool.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <threads.h>
+
+#define BP_MAX_CLASS_SIZE ((size_t)BP_MIN_CLASS_SIZE << (BP_NUM_CLASSES - 1))
+
+//Kept at the start of each buffer in the shared pool, so holding onto one costs no memory of its own
+struct pooledBuffer
+{
+    struct pooledBuffer *next;
+    size_t capacity;
+};
+
+struct bpCounters
+{
+    atomic_size_t hits;
+    atomic_size_t misses;
+    atomic_size_t returned;
+    atomic_size_t discarded;
+};
+
+static struct
+{
+    once_flag initFlag;
+    mtx_t mutex;
+    tss_t threadExitKey; //Only there for its destructor, which passes a finished thread's cache on to the shared pool
+    struct pooledBuffer *buffers[BP_NUM_CLASSES];
+    size_t numBuffers[BP_NUM_CLASSES];
+    struct bpCounters counters[BP_NUM_CLASSES];
+    atomic_size_t oversized;
+} bufferPool = { .initFlag = ONCE_FLAG_INIT };
+
+struct bpThreadCache
+{
+    bool registered;
+    size_t numBytes; //Capacity of all the buffers held, which stays within BP_THREAD_CACHE_BYTES
+    size_t numBuffers[BP_NUM_CLASSES];
+    resizableBuffer buffers[BP_NUM_CLASSES][BP_THREAD_CACHE_COUNT];
+};
+
+static thread_local struct bpThreadCache threadCache;
+
+static size_t class_size(size_t sizeClass)
+{
+    return (size_t)BP_MIN_CLASS_SIZE << sizeClass;
+}
+
+//The smallest size class whose buffers all hold minCapacity bytes, or BP_NUM_CLASSES if none do
+static size_t take_class(size_t minCapacity)
+{
+    size_t sizeClass = 0;
+    while (sizeClass < BP_NUM_CLASSES && class_size(sizeClass) < minCapacity) sizeClass++;
+    return sizeClass;
+}
+
+//The size class a buffer with the given capacity belongs in, or BP_NUM_CLASSES if it's too small or too big for all of them
+static size_t return_class(size_t capacity)
+{
+    if (capacity < BP_MIN_CLASS_SIZE || capacity >= BP_MAX_CLASS_SIZE * 2) return BP_NUM_CLASSES;
+    size_t sizeClass = 0;
+    while (sizeClass + 1 < BP_NUM_CLASSES && class_size(sizeClass + 1) <= capacity) sizeClass++;
+    return sizeClass;
+}
+
+//Must be called with the mutex held
+static void push_shared(size_t sizeClass, resizableBuffer buffer)
+{
+    if (bufferPool.numBuffers[sizeClass] * class_size(sizeClass) >= BP_SHARED_CLASS_BYTES)
+    {
+        atomic_fetch_add_explicit(&bufferPool.counters[sizeClass].discarded, 1, memory_order_relaxed);
+        free(buffer.contents);
+        return;
+    }
+    struct pooledBuffer *node = buffer.contents;
+    *node = (struct pooledBuffer) { .next = bufferPool.buffers[sizeClass], .capacity = buffer.capacity };
+    bufferPool.buffers[sizeClass] = node;
+    bufferPool.numBuffers[sizeClass]++;
+}
+
+static void flush_thread_cache(struct bpThreadCache *cache, size_t sizeClass)
+{
+    for (size_t i = 0; i < cache->numBuffers[sizeClass]; i++)
+    {
+        cache->numBytes -= cache->buffers[sizeClass][i].capacity;
+        push_shared(sizeClass, cache->buffers[sizeClass][i]);
+    }
+    cache->numBuffers[sizeClass] = 0;
+}
+
+static void bp_thread_exit(void *cache)
+{
+    mtx_lock(&bufferPool.mutex);
+    for (size_t sizeClass = 0; sizeClass < BP_NUM_CLASSES; sizeClass++)
+    {
+        flush_thread_cache(cache, sizeClass);
+    }
+    mtx_unlock(&bufferPool.mutex);
+}
+
+static void bp_init()
+{
+    mtx_init(&bufferPool.mutex, mtx_plain);
+    tss_create(&bufferPool.threadExitKey, bp_thread_exit);
+}
+
+static struct bpThreadCache *bp_thread_cache()
+{
+    call_once(&bufferPool.initFlag, bp_init);
+    if (!threadCache.registered)
+    {
+        tss_set(bufferPool.threadExitKey, &threadCache);
+        threadCache.registered = true;
+    }
+    return &threadCache;
+}
+
+resizableBuffer bp_take(size_t minCapacity)
+{
+    size_t sizeClass = take_class(minCapacity);
+    if (sizeClass == BP_NUM_CLASSES)
+    {
+        atomic_fetch_add_explicit(&bufferPool.oversized, 1, memory_order_relaxed);
+        void *contents = malloc(minCapacity);
+        if (contents == nullptr) return RB_EMPTY;
+        return (resizableBuffer) { .count = 0, .capacity = minCapacity, .contents = contents };
+    }
+
+    //A bigger buffer than was asked for is handed out if that's all there is, since responses outgrowing theirs
+    //is what costs the most: the big buffers the last few responses grew into go straight to the next few
+    struct bpThreadCache *cache = bp_thread_cache();
+    size_t found = sizeClass;
+    while (found < BP_NUM_CLASSES && cache->numBuffers[found] == 0) found++;
+    if (found == BP_NUM_CLASSES)
+    {
+        //Take a few at once, so the next several calls don't need the lock either. The first is handed out right away,
+        //so it's taken even if the cache is full.
+        mtx_lock(&bufferPool.mutex);
+        found = sizeClass;
+        while (found < BP_NUM_CLASSES && bufferPool.buffers[found] == nullptr) found++;
+        while (found < BP_NUM_CLASSES && cache->numBuffers[found] < BP_THREAD_CACHE_COUNT && bufferPool.buffers[found] != nullptr
+               && (cache->numBuffers[found] == 0
+                   || cache->numBytes + bufferPool.buffers[found]->capacity <= BP_THREAD_CACHE_BYTES))
+        {
+            struct pooledBuffer *node = bufferPool.buffers[found];
+            cache->numBytes += node->capacity;
+            bufferPool.buffers[found] = node->next;
+            bufferPool.numBuffers[found]--;
+            cache->buffers[found][cache->numBuffers[found]++] =
+                    (resizableBuffer) { .count = 0, .capacity = node->capacity, .contents = node };
+        }
+        mtx_unlock(&bufferPool.mutex);
+    }
+    if (found != BP_NUM_CLASSES)
+    {
+        atomic_fetch_add_explicit(&bufferPool.counters[sizeClass].hits, 1, memory_order_relaxed);
+        resizableBuffer output = cache->buffers[found][--cache->numBuffers[found]];
+        cache->numBytes -= output.capacity;
+        return output;
+    }
+
+    atomic_fetch_add_explicit(&bufferPool.counters[sizeClass].misses, 1, memory_order_relaxed);
+    void *contents = malloc(class_size(sizeClass));
+    if (contents == nullptr) return RB_EMPTY;
+    return (resizableBuffer) { .count = 0, .capacity = class_size(sizeClass), .contents = contents };
+}
+
+bool bp_reserve(resizableBuffer *buffer, size_t numBytes)
+{
+    size_t requiredCapacity = buffer->count + numBytes;
+    if (requiredCapacity <= buffer->capacity) return true;
+    size_t newCapacity = buffer->capacity * 2;
+    if (newCapacity < requiredCapacity) newCapacity = requiredCapacity;
+    //Growing in place with realloc beats swapping in a bigger buffer from the pool, which always means a copy.
+    //Rounding up to a size class just makes sure the buffer fits one exactly once it's given back.
+    size_t sizeClass = take_class(newCapacity);
+    if (sizeClass != BP_NUM_CLASSES) newCapacity = class_size(sizeClass);
+    void *newBuf = realloc(buffer->contents, newCapacity);
+    if (newBuf == nullptr) return false;
+    buffer->contents = newBuf;
+    buffer->capacity = newCapacity;
+    return true;
+}
+
+void bp_return(resizableBuffer *buffer)
+{
+    resizableBuffer returned = { .count = 0, .capacity = buffer->capacity, .contents = buffer->contents };
+    *buffer = RB_EMPTY;
+    if (returned.contents == nullptr) return;
+    size_t sizeClass = return_class(returned.capacity);
+    if (sizeClass == BP_NUM_CLASSES)
+    {
+        free(returned.contents);
+        return;
+    }
+
+    atomic_fetch_add_explicit(&bufferPool.counters[sizeClass].returned, 1, memory_order_relaxed);
+    struct bpThreadCache *cache = bp_thread_cache();
+    if (cache->numBuffers[sizeClass] < BP_THREAD_CACHE_COUNT && cache->numBytes + returned.capacity <= BP_THREAD_CACHE_BYTES)
+    {
+        cache->buffers[sizeClass][cache->numBuffers[sizeClass]++] = returned;
+        cache->numBytes += returned.capacity;
+        return;
+    }
+    //The cache is full, so all of its buffers of this size go to the shared pool in one go, leaving room for the next few
+    mtx_lock(&bufferPool.mutex);
+    flush_thread_cache(cache, sizeClass);
+    push_shared(sizeClass, returned);
+    mtx_unlock(&bufferPool.mutex);
+}
+
+bpStats bp_get_stats()
+{
+    bpStats stats = { .oversized = atomic_load(&bufferPool.oversized) };
+    for (size_t sizeClass = 0; sizeClass < BP_NUM_CLASSES; sizeClass++)
+    {
+        struct bpCounters *counters = &bufferPool.counters[sizeClass];
+        stats.classes[sizeClass] = (bpClassStats)
+        {
+            .capacity = class_size(sizeClass),
+            .hits = atomic_load(&counters->hits),
+            .misses = atomic_load(&counters->misses),
+            .returned = atomic_load(&counters->returned),
+            .discarded = atomic_load(&counters->discarded)
+        };
+    }
+    return stats;
+}
+
+void bp_dump_stats(FILE *stream)
+{
+    bpStats stats = bp_get_stats();
+    fprintf(stream, "Buffer pool: %zu takes too big to pool\n", stats.oversized);
+    for (size_t sizeClass = 0; sizeClass < BP_NUM_CLASSES; sizeClass++)
+    {
+        bpClassStats *counters = &stats.classes[sizeClass];
+        size_t takes = counters->hits + counters->misses;
+        if (takes == 0 && counters->returned == 0) continue;
+        fprintf(stream, "  %5zuKB: %zu hits, %zu misses(%.1f%% hit rate), %zu returned, %zu discarded\n",
+                counters->capacity / 1024, counters->hits, counters->misses,
+                takes != 0 ? 100.0 * (double)counters->hits / (double)takes : 0.0, counters->returned, counters->discarded);
+    }
+}
+
+void bp_reset_stats()
+{
+    for (size_t sizeClass = 0; sizeClass < BP_NUM_CLASSES; sizeClass++)
+    {
+        atomic_store(&bufferPool.counters[sizeClass].hits, 0);
+        atomic_store(&bufferPool.counters[sizeClass].misses, 0);
+        atomic_store(&bufferPool.counters[sizeClass].returned, 0);
+        atomic_store(&bufferPool.counters[sizeClass].discarded, 0);
+    }
+    atomic_store(&bufferPool.oversized, 0);
+}
\ No newline at end of file
@@ -0,0 +1,81 @@
+/*
+*  This Source Code Form is subject to the terms of the Mozilla Public
+*  License, v. 2.0. If a copy of the MPL was not distributed with this
+*  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#ifndef GOPHERBROWSER_BUFFER_POOL_H
+#define GOPHERBROWSER_BUFFER_POOL_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include "buffer-utils.h"
+
+//Capacity of the smallest size class. Each one after it is twice the size of the last.
+#define BP_MIN_CLASS_SIZE (16 * 1024)
+//Number of size classes, so the largest holds buffers of BP_MIN_CLASS_SIZE << (BP_NUM_CLASSES - 1) bytes, or 4 MB
+#define BP_NUM_CLASSES 9
+//Buffers of each size class a thread keeps for itself before passing them on to the shared pool
+#define BP_THREAD_CACHE_COUNT 4
+//Most memory a thread keeps for itself across all size classes, which is room for one buffer of the largest.
+//Buffers that would take it past that go to the shared pool instead.
+#define BP_THREAD_CACHE_BYTES (4 * 1024 * 1024)
+//Most memory the shared pool holds onto for each size class; buffers returned past that are freed
+#define BP_SHARED_CLASS_BYTES (8 * 1024 * 1024)
+
+/*
+ Counters for one size class of the pool.
+ */
+typedef struct bpClassStats
+{
+    size_t capacity;
+    size_t hits; //bp_take calls asking for this size class that were served from the pool, perhaps with a bigger buffer
+    size_t misses; //bp_take calls that had to allocate
+    size_t returned; //Buffers given back and kept for reuse
+    size_t discarded; //Buffers given back and freed, because the pool was full
+} bpClassStats;
+
+typedef struct bpStats
+{
+    bpClassStats classes[BP_NUM_CLASSES];
+    size_t oversized; //bp_take calls for more than the largest size class, which are never pooled
+} bpStats;
+
+/*
+ Gets an empty buffer with room for at least minCapacity bytes from the process-wide pool of I/O buffers.
+ The smallest pooled buffer big enough is used, even if it belongs to a bigger size class than minCapacity needs;
+ if there is none, one of the next size class up is allocated. The contents are not zeroed.
+ Each thread keeps a few buffers to itself(see BP_THREAD_CACHE_BYTES), so most calls don't take a lock.
+ They're passed on to the shared pool when the thread exits.
+ Buffers from the pool are ordinary heap memory, so rb_free works on them too; bp_return just lets them be reused.
+ */
+resizableBuffer bp_take(size_t minCapacity);
+
+/*
+ Same as rb_reserve, but a buffer that has to grow is grown to the capacity of a size class,
+ so that it can be pooled once it's given back. Returns false, leaving the buffer as it was, if it couldn't grow.
+ */
+bool bp_reserve(resizableBuffer *buffer, size_t numBytes);
+
+/*
+ Gives a buffer back to the pool, leaving it empty. Buffers that weren't taken from it are fine too,
+ as long as they came from malloc; ones too small or too big for any size class are freed.
+ */
+void bp_return(resizableBuffer *buffer);
+
+/*
+ Gets a snapshot of the pool's counters. Safe to call from any thread.
+ */
+bpStats bp_get_stats();
+
+/*
+ Writes the pool's counters for each size class to the specified stream.
+ */
+void bp_dump_stats(FILE *stream);
+
+/*
+ Clears the pool's counters, without touching the buffers it holds.
+ */
+void bp_reset_stats();
+
+#endif //GOPHERBROWSER_BUFFER_POOL_H
\ No newline at end of file
@@ -5,6 +5,7 @@
 */
 
 #include "buffer-utils.h"
+#include "buffer-pool.h"
 
 resizableBuffer rb_new(size_t initialCapacity)
 {
@@ -24,12 +25,16 @@ void rb_free(resizableBuffer *buffer)
     buffer->contents = nullptr;
 }
 
-void rb_append(resizableBuffer *buffer, size_t numBytes, void *input)
+/*
+ Copies numBytes bytes onto the end of the buffer.
+ Returns false, leaving the buffer as it was, if it couldn't grow to fit them.
+ */
+bool rb_append(resizableBuffer *buffer, size_t numBytes, void *input)
 {
-    size_t requiredCapacity = buffer->count + numBytes;
-    if (requiredCapacity > buffer->capacity) rb_resize(buffer, requiredCapacity);
-    memcpy(buffer->contents + buffer->count, input, numBytes);
+    if (!rb_reserve(buffer, numBytes)) return false;
+    memcpy(rb_tail(buffer), input, numBytes);
     buffer->count += numBytes;
+    return true;
 }
 
 /*
@@ -40,14 +45,95 @@ void rb_append(resizableBuffer *buffer, size_t numBytes, void *input)
 void rb_resize(resizableBuffer *buffer, size_t newSize)
 {
     if (buffer->capacity == newSize) return;
-    size_t newCount = newSize >= buffer->count ? buffer->count : newSize;
-    void *newBuf = calloc(newSize, 1);
-    memcpy(newBuf, buffer->contents, newCount);
-    free(buffer->contents);
+    void *newBuf = realloc(buffer->contents, newSize);
+    if (newBuf == nullptr && newSize != 0) return;
+    if (newSize > buffer->capacity) memset((char *)newBuf + buffer->capacity, 0, newSize - buffer->capacity);
+    if (buffer->count > newSize) buffer->count = newSize;
     buffer->contents = newBuf;
     buffer->capacity = newSize;
 }
 
+/*
+ Makes sure there is room for at least numBytes more bytes after the current contents.
+ The capacity is at least doubled whenever it has to grow, so repeated appends take amortized linear time.
+ Unlike rb_resize, the new space is not zeroed.
+ Returns false, leaving the buffer as it was, if it couldn't grow.
+ */
+bool rb_reserve(resizableBuffer *buffer, size_t numBytes)
+{
+    size_t requiredCapacity = buffer->count + numBytes;
+    if (requiredCapacity <= buffer->capacity) return true;
+    size_t newCapacity = buffer->capacity < DEFAULT_BUFFER_SIZE ? DEFAULT_BUFFER_SIZE : buffer->capacity * 2;
+    if (newCapacity < requiredCapacity) newCapacity = requiredCapacity;
+    void *newBuf = realloc(buffer->contents, newCapacity);
+    if (newBuf == nullptr) return false;
+    buffer->contents = newBuf;
+    buffer->capacity = newCapacity;
+    return true;
+}
+
+/*
+ Gets a pointer to the first unused byte of the buffer, so that data can be written there directly(e.g. by recv).
+ Call rb_reserve first to make sure there is space, and rb_commit afterwards to account for the bytes written.
+ */
+void *rb_tail(resizableBuffer *buffer)
+{
+    return (char *)buffer->contents + buffer->count;
+}
+
+/*
+ Marks numBytes bytes written past the end of the contents(see rb_tail) as part of the buffer.
+ */
+void rb_commit(resizableBuffer *buffer, size_t numBytes)
+{
+    buffer->count += numBytes;
+}
+
+sharedBuffer *srb_new(resizableBuffer buffer)
+{
+    sharedBuffer *shared = malloc(sizeof(sharedBuffer));
+    atomic_init(&shared->refCount, 1);
+    shared->buffer = buffer;
+    return shared;
+}
+
+sharedBuffer *srb_ref(sharedBuffer *shared)
+{
+    if (shared != nullptr) atomic_fetch_add(&shared->refCount, 1);
+    return shared;
+}
+
+void srb_release(sharedBuffer *shared)
+{
+    if (shared == nullptr) return;
+    if (atomic_fetch_sub(&shared->refCount, 1) == 1)
+    {
+        bp_return(&shared->buffer);
+        free(shared);
+    }
+}
+
+/*
+ Releases the caller's reference and returns a buffer the caller owns outright.
+ If nobody else holds a reference, the data is handed over as-is; otherwise it is copied.
+ The copy keeps a NUL byte just past the data, as the original has.
+ */
+resizableBuffer srb_take(sharedBuffer *shared)
+{
+    if (shared == nullptr) return RB_EMPTY;
+    resizableBuffer output;
+    if (atomic_load(&shared->refCount) == 1)
+    {
+        output = shared->buffer;
+        free(shared);
+        return output;
+    }
+    output = bp_take(shared->buffer.count + 1);
+    if (!rb_append(&output, shared->buffer.count, shared->buffer.contents)) bp_return(&output);
+    srb_release(shared);
+    return output;
+}
+
 void printBuffer(void *buf, size_t n, int bytesPerRow)
 {
     size_t numberRows = (n/2) % bytesPerRow == 0 ? (n/2) / bytesPerRow : (n/2) / bytesPerRow + 1;
@@ -61,35 +147,141 @@ void printBuffer(void *buf, size_t n, int bytesPerRow)
     }
 }
 
-temporaryMem tm_new()
+memArena ma_new()
+{
+    return MA_EMPTY;
+}
+
+//Carves the allocation out of the chunk, or returns nullptr if it doesn't fit
+static void *ma_chunk_alloc(maChunk *chunk, size_t size, size_t alignment)
+{
+    uintptr_t start = ((uintptr_t)(chunk->data + chunk->used) + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    size_t offset = start - (uintptr_t)chunk->data;
+    if (offset > chunk->capacity || chunk->capacity - offset < size) return nullptr;
+    chunk->used = offset + size;
+    return (void *)start;
+}
+
+void *ma_alloc(memArena *arena, size_t size, size_t alignment)
+{
+    if (arena->current != nullptr)
+    {
+        void *output = ma_chunk_alloc(arena->current, size, alignment);
+        if (output != nullptr) return output;
+        //A chunk kept from before the last reset is reused before a new one is made
+        maChunk *next = arena->current->next;
+        if (next != nullptr)
+        {
+            next->used = 0;
+            output = ma_chunk_alloc(next, size, alignment);
+            if (output != nullptr)
+            {
+                arena->current = next;
+                return output;
+            }
+        }
+    }
+    size_t capacity = arena->current != nullptr ? arena->current->capacity * 2 : MA_MIN_CHUNK_SIZE;
+    if (capacity > MA_MAX_CHUNK_SIZE) capacity = MA_MAX_CHUNK_SIZE;
+    if (capacity < size + alignment) capacity = size + alignment;
+    maChunk *chunk = malloc(sizeof(maChunk) + capacity);
+    if (chunk == nullptr) return nullptr;
+    chunk->capacity = capacity;
+    chunk->used = 0;
+    //New chunks go right after the current one, so any kept from before the last reset are still ahead of it
+    if (arena->current != nullptr)
+    {
+        chunk->next = arena->current->next;
+        arena->current->next = chunk;
+    }
+    else
+    {
+        chunk->next = arena->first;
+        arena->first = chunk;
+    }
+    arena->current = chunk;
+    return ma_chunk_alloc(chunk, size, alignment);
+}
+
+void *ma_calloc(memArena *arena, size_t count, size_t size)
+{
+    if (size != 0 && count > SIZE_MAX / size) return nullptr;
+    void *output = ma_alloc(arena, count * size, alignof(max_align_t));
+    if (output != nullptr) memset(output, 0, count * size);
+    return output;
+}
+
+void *ma_add(memArena *arena, const void *contents, size_t size)
+{
+    void *output = ma_alloc(arena, size, alignof(max_align_t));
+    if (output != nullptr) memcpy(output, contents, size);
+    return output;
+}
+
+char *ma_strdup(memArena *arena, const char *string)
+{
+    size_t size = strlen(string) + 1;
+    char *output = ma_alloc(arena, size, 1);
+    if (output != nullptr) memcpy(output, string, size);
+    return output;
+}
+
+bool ma_adopt(memArena *arena, void *pointer)
+{
+    if (pointer == nullptr) return true;
+    maAdopted *node = ma_alloc(arena, sizeof(maAdopted), alignof(maAdopted));
+    if (node == nullptr)
+    {
+        free(pointer);
+        return false;
+    }
+    *node = (maAdopted) { .pointer = pointer, .capacity = 0, .next = arena->adopted };
+    arena->adopted = node;
+    return true;
+}
+
+bool ma_adopt_buffer(memArena *arena, resizableBuffer buffer)
 {
-    return (temporaryMem) { .freed = false, .next = nullptr, .last = nullptr };
+    if (buffer.contents == nullptr) return true;
+    maAdopted *node = ma_alloc(arena, sizeof(maAdopted), alignof(maAdopted));
+    if (node == nullptr)
+    {
+        bp_return(&buffer);
+        return false;
+    }
+    *node = (maAdopted) { .pointer = buffer.contents, .capacity = buffer.capacity, .next = arena->adopted };
+    arena->adopted = node;
+    return true;
 }
 
-void *tm_add(temporaryMem *mem, void *contents, size_t contentSize)
+//The nodes themselves live in the arena, so this has to happen before its memory is reused
+static void ma_free_adopted(memArena *arena)
 {
-    tMemNode *node = calloc(1, sizeof(tMemNode));
-    void *buffer = calloc(1, contentSize);
-    memcpy(buffer, contents, contentSize);
-    if (mem->next == nullptr) mem->next = node;
-    else mem->last->next = node;
-    mem->last = node;
-    return buffer;
+    for (maAdopted *node = arena->adopted; node != nullptr; node = node->next)
+    {
+        if (node->capacity == 0) free(node->pointer);
+        else bp_return(&(resizableBuffer) { .count = 0, .capacity = node->capacity, .contents = node->pointer });
+    }
+    arena->adopted = nullptr;
 }
 
-void tm_node_free(tMemNode *node)
+void ma_reset(memArena *arena)
 {
-    if (node->next != nullptr) tm_node_free(node->next);
-    free(node->buffer);
-    free(node);
+    ma_free_adopted(arena);
+    //The rest of the chunks are marked empty as allocation reaches them
+    arena->current = arena->first;
+    if (arena->first != nullptr) arena->first->used = 0;
 }
 
-void tm_free(temporaryMem *mem)
+void ma_free(memArena *arena)
 {
-    if (mem->freed) return;
-    mem->freed = true;
-    if (mem->next != nullptr)
-        tm_node_free(mem->next);
-    mem->next = nullptr;
-    mem->last = nullptr;
+    ma_free_adopted(arena);
+    maChunk *chunk = arena->first;
+    while (chunk != nullptr)
+    {
+        maChunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    *arena = MA_EMPTY;
 }
\ No newline at end of file
@@ -8,6 +8,7 @@
 #define GOPHERBROWSER_BUFFER_UTILS_H
 
 #include <stddef.h>
+#include <stdint.h>
 #include <malloc.h>
 #include <string.h>
 #include <stdatomic.h>
@@ -24,28 +25,107 @@ typedef struct resizableBuffer
 resizableBuffer rb_new(size_t initialCapacity);
 #define rb_new_with_default_size() rb_new(DEFAULT_BUFFER_SIZE)
 void rb_free(resizableBuffer *buffer);
-void rb_append(resizableBuffer *buffer, size_t numBytes, void *input);
+bool rb_append(resizableBuffer *buffer, size_t numBytes, void *input);
 void rb_resize(resizableBuffer *buffer, size_t newSize);
+bool rb_reserve(resizableBuffer *buffer, size_t numBytes);
+void *rb_tail(resizableBuffer *buffer);
+void rb_commit(resizableBuffer *buffer, size_t numBytes);
+#define rb_spare_capacity(_rb) ((_rb).capacity - (_rb).count)
 #define RB_EMPTY ((resizableBuffer) { 0 })
 
+/*
+ Reference-counted, read-only wrapper around a resizableBuffer, for data several owners hold at once.
+ Should be created with srb_new and released with srb_release.
+ */
+typedef struct sharedBuffer
+{
+    atomic_size_t refCount;
+    resizableBuffer buffer;
+} sharedBuffer;
+
+sharedBuffer *srb_new(resizableBuffer buffer); //Takes ownership of buffer
+sharedBuffer *srb_ref(sharedBuffer *shared);
+void srb_release(sharedBuffer *shared);
+resizableBuffer srb_take(sharedBuffer *shared);
+
 
-typedef struct tMemNode
+//Size of the first chunk an arena allocates. Each one after it is twice the size of the last, up to MA_MAX_CHUNK_SIZE.
+#define MA_MIN_CHUNK_SIZE (16 * 1024)
+#define MA_MAX_CHUNK_SIZE (1024 * 1024)
+
+typedef struct maChunk
 {
-    void *buffer;
-    struct tMemNode *next;
-} tMemNode;
+    struct maChunk *next;
+    size_t capacity;
+    size_t used;
+    unsigned char data[];
+} maChunk;
 
-typedef struct temporaryMem
+typedef struct maAdopted
 {
-    atomic_bool freed;
-    struct tMemNode *next;
-    struct tMemNode *last;
-} temporaryMem;
+    void *pointer;
+    size_t capacity; //Non-zero for a buffer that goes back to the buffer pool(see ma_adopt_buffer) rather than being freed
+    struct maAdopted *next;
+} maAdopted;
 
-temporaryMem tm_new();
-void tm_free(temporaryMem *mem);
+/*
+ Bump allocator for memory that all goes away at once, like everything belonging to a page.
+ Allocations are carved out of large chunks, and are never freed individually; ma_reset gives them all back at once
+ while keeping the chunks for reuse, and ma_free releases the chunks too.
+ Not thread-safe. Should be created with ma_new or MA_EMPTY.
+ */
+typedef struct memArena
+{
+    maChunk *first;
+    maChunk *current; //The chunk allocations are being made from
+    maAdopted *adopted; //Heap allocations to free on reset
+} memArena;
+
+#define MA_EMPTY ((memArena) { 0 })
+
+memArena ma_new();
 
-void *tm_add(temporaryMem *mem, void *contents, size_t contentSize);
+/*
+ Allocates size bytes at the specified alignment, which must be a power of two. The memory is not zeroed.
+ */
+void *ma_alloc(memArena *arena, size_t size, size_t alignment);
+
+/*
+ Allocates a zeroed array of count elements of size bytes each, suitably aligned for any type.
+ */
+void *ma_calloc(memArena *arena, size_t count, size_t size);
+
+/*
+ Copies size bytes from contents into the arena, suitably aligned for any type.
+ */
+void *ma_add(memArena *arena, const void *contents, size_t size);
+
+/*
+ Copies the string, null terminator and all, into the arena.
+ */
+char *ma_strdup(memArena *arena, const char *string);
+
+/*
+ Makes the arena responsible for freeing a block from malloc, e.g. a response buffer too big to be worth copying in.
+ Returns false if the arena couldn't grow to keep track of it, in which case the block is freed straight away.
+ */
+bool ma_adopt(memArena *arena, void *pointer);
+
+/*
+ Same as ma_adopt, but for a response buffer, which is given back to the buffer pool(see bp_return) instead of freed.
+ */
+bool ma_adopt_buffer(memArena *arena, resizableBuffer buffer);
+
+/*
+ Frees everything the arena has adopted and makes all of its memory available again, without giving the chunks back.
+ Anything allocated from it before is invalid afterwards.
+ */
+void ma_reset(memArena *arena);
+
+/*
+ Frees everything the arena has adopted and all of its chunks.
+ */
+void ma_free(memArena *arena);
 
 void printBuffer(void *buf, size_t n, int bytesPerRow);
 
@@ -0,0 +1,240 @@
+/*
+*  This Source Code Form is subject to the terms of the Mozilla Public
+*  License, v. 2.0. If a copy of the MPL was not distributed with this
+*  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+//Micro-benchmarks for the containers in collections.h, each against the hand-rolled code it replaced.
+//Run with no arguments; every result is the best of BENCH_RUNS runs.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "collections.h"
+
+#define BENCH_RUNS 5
+#define VECTOR_ITEMS 50000
+#define MAP_KEYS 1024
+#define MAP_ROUNDS 1000
+#define QUEUE_ITEMS 1000000
+
+//About the size of a gopherEntity
+typedef struct benchItem
+{
+    char bytes[96];
+} benchItem;
+
+struct chainedEntry
+{
+    uint32_t key;
+    uint64_t value;
+    struct chainedEntry *next;
+};
+
+struct listTask
+{
+    void *arg;
+    struct listTask *next;
+};
+
+CREATE_VECTOR_TYPE(itemVector, iv, benchItem)
+CREATE_STACK_TYPE(itemStack, is, benchItem)
+#define U32_HASH(key) coll_hash_u64(key)
+#define U32_EQUAL(a, b) ((a) == (b))
+CREATE_HASH_MAP_TYPE(u64Map, um, uint32_t, uint64_t, U32_HASH, U32_EQUAL)
+CREATE_RING_BUFFER_TYPE(pointerQueue, pq, void *)
+
+static volatile uint64_t sink; //Keeps the compiler from throwing away the work
+
+static double now_ms()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec * 1e3 + (double)now.tv_nsec / 1e6;
+}
+
+//The old parse_gopher_menu: a fresh calloc 32 items bigger, and a copy, every 32 items
+static void fixed_step_array()
+{
+    size_t count = 0, capacity = 32;
+    benchItem *items = calloc(capacity, sizeof(benchItem));
+    for (size_t i = 0; i < VECTOR_ITEMS; i++)
+    {
+        if (count == capacity)
+        {
+            benchItem *newItems = calloc(capacity += 32, sizeof(benchItem));
+            memcpy(newItems, items, count * sizeof(benchItem));
+            free(items);
+            items = newItems;
+        }
+        items[count++].bytes[0] = (char)i;
+    }
+    sink += items[count - 1].bytes[0];
+    free(items);
+}
+
+static void vector()
+{
+    itemVector items = iv_new(32);
+    for (size_t i = 0; i < VECTOR_ITEMS; i++)
+    {
+        iv_push(&items, (benchItem) { .bytes = { (char)i } });
+    }
+    sink += items.items[items.count - 1].bytes[0];
+    iv_free(&items);
+}
+
+static void stack()
+{
+    itemStack items = is_new(0);
+    for (size_t i = 0; i < VECTOR_ITEMS; i++)
+    {
+        is_push(&items, (benchItem) { .bytes = { (char)i } });
+    }
+    benchItem item;
+    while (is_pop(&items, &item)) sink += item.bytes[0];
+    is_free(&items);
+}
+
+//The old addr cache: separate chaining, with a calloc for every entry.
+//Like the cache, it holds a few hundred to a thousand hosts, and sees far more lookups than inserts.
+static void chained_map()
+{
+    size_t numBuckets = 8, numEntries = 0;
+    struct chainedEntry **buckets = calloc(numBuckets, sizeof(struct chainedEntry *));
+    for (uint32_t key = 0; key < MAP_KEYS; key++)
+    {
+        if (numEntries >= numBuckets)
+        {
+            size_t newNumBuckets = numBuckets * 2;
+            struct chainedEntry **newBuckets = calloc(newNumBuckets, sizeof(struct chainedEntry *));
+            for (size_t i = 0; i < numBuckets; i++)
+            {
+                struct chainedEntry *entry = buckets[i];
+                while (entry != nullptr)
+                {
+                    struct chainedEntry *next = entry->next;
+                    size_t index = coll_hash_u64(entry->key) & (newNumBuckets - 1);
+                    entry->next = newBuckets[index];
+                    newBuckets[index] = entry;
+                    entry = next;
+                }
+            }
+            free(buckets);
+            buckets = newBuckets;
+            numBuckets = newNumBuckets;
+        }
+        struct chainedEntry *entry = calloc(1, sizeof(struct chainedEntry));
+        *entry = (struct chainedEntry) { .key = key, .value = key };
+        size_t index = coll_hash_u64(key) & (numBuckets - 1);
+        entry->next = buckets[index];
+        buckets[index] = entry;
+        numEntries++;
+    }
+    for (size_t round = 0; round < MAP_ROUNDS; round++)
+    {
+        for (uint32_t key = 0; key < MAP_KEYS; key++)
+        {
+            for (struct chainedEntry *entry = buckets[coll_hash_u64(key) & (numBuckets - 1)]; entry != nullptr; entry = entry->next)
+            {
+                if (entry->key != key) continue;
+                sink += entry->value;
+                break;
+            }
+        }
+    }
+    for (size_t i = 0; i < numBuckets; i++)
+    {
+        struct chainedEntry *entry = buckets[i];
+        while (entry != nullptr)
+        {
+            struct chainedEntry *next = entry->next;
+            free(entry);
+            entry = next;
+        }
+    }
+    free(buckets);
+}
+
+static void hash_map()
+{
+    u64Map map = um_new(0);
+    for (uint32_t key = 0; key < MAP_KEYS; key++)
+    {
+        um_put(&map, key, key);
+    }
+    for (size_t round = 0; round < MAP_ROUNDS; round++)
+    {
+        for (uint32_t key = 0; key < MAP_KEYS; key++)
+        {
+            sink += *um_get(&map, key);
+        }
+    }
+    um_free(&map);
+}
+
+//The old thread pool queue: a calloc'd node per task
+static void linked_queue()
+{
+    struct listTask *head = nullptr, *tail = nullptr;
+    for (size_t round = 0; round < QUEUE_ITEMS / 16; round++)
+    {
+        for (size_t i = 0; i < 16; i++)
+        {
+            struct listTask *task = calloc(1, sizeof(struct listTask));
+            task->arg = (void *)i;
+            if (tail == nullptr) head = task;
+            else tail->next = task;
+            tail = task;
+        }
+        while (head != nullptr)
+        {
+            struct listTask *task = head;
+            head = task->next;
+            if (head == nullptr) tail = nullptr;
+            sink += (uintptr_t)task->arg;
+            free(task);
+        }
+    }
+}
+
+static void ring_buffer()
+{
+    pointerQueue queue = pq_new(0);
+    for (size_t round = 0; round < QUEUE_ITEMS / 16; round++)
+    {
+        for (size_t i = 0; i < 16; i++)
+        {
+            pq_push(&queue, (void *)i);
+        }
+        void *arg;
+        while (pq_pop(&queue, &arg)) sink += (uintptr_t)arg;
+    }
+    pq_free(&queue);
+}
+
+static void run(const char *name, void (*benchmark)())
+{
+    double best = 0;
+    for (int i = 0; i < BENCH_RUNS; i++)
+    {
+        double start = now_ms();
+        benchmark();
+        double elapsed = now_ms() - start;
+        if (i == 0 || elapsed < best) best = elapsed;
+    }
+    printf("%-40s %10.3fms\n", name, best);
+}
+
+int main()
+{
+    run("append 50k items, +32 calloc and copy", fixed_step_array);
+    run("append 50k items, vector", vector);
+    run("push and pop 50k items, stack", stack);
+    run("1k inserts, 1M lookups, chained", chained_map);
+    run("1k inserts, 1M lookups, hash map", hash_map);
+    run("1M tasks queued, linked list", linked_queue);
+    run("1M tasks queued, ring buffer", ring_buffer);
+    return 0;
+}
\ No newline at end of file
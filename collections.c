@@ -4,4 +4,16 @@
 *  file, You can obtain one at http://mozilla.org/MPL/2.0/.
 */
 
-#include "collections.h"
\ No newline at end of file
+#include "collections.h"
+
+uint64_t coll_hash_bytes(const void *bytes, size_t length)
+{
+    const unsigned char *data = bytes;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash ^= data[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
\ No newline at end of file
@@ -7,6 +7,348 @@
 #ifndef GOPHERBROWSER_COLLECTIONS_H
 #define GOPHERBROWSER_COLLECTIONS_H
 
-#define CREATE_STACK_TYPE()
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ Each CREATE_*_TYPE macro defines a container type holding items of the specified type, along with static inline
+ functions for it whose names start with the specified prefix, the same way the rest of the code base names things
+ (e.g. CREATE_VECTOR_TYPE(entityVector, ev, gopherEntity) gives entityVector, ev_new, ev_push and so on).
+ They can be used in a header or a single source file. All of them start out empty when zeroed,
+ grow by doubling so adding items takes amortized constant time, and are freed with prefix_free.
+ Functions that have to grow the container return false or nullptr if they can't, leaving it as it was.
+ */
+
+//Capacity a container grows to the first time something is added to it. Must be a power of two.
+#define COLL_MIN_CAPACITY 8
+//Smallest number of slots a hash map allocates. Must be a power of two.
+#define COLL_MAP_MIN_SLOTS 8
+
+//States of a hash map slot
+#define COLL_SLOT_EMPTY 0
+#define COLL_SLOT_FULL 1
+#define COLL_SLOT_DELETED 2 //Removed, but still part of the probe sequence of anything placed after it
+
+/*
+ Gets the capacity to grow a container to so it holds at least required items: at least double the current one.
+ */
+static inline size_t coll_grow_capacity(size_t capacity, size_t required)
+{
+    size_t newCapacity = capacity < COLL_MIN_CAPACITY / 2 ? COLL_MIN_CAPACITY : capacity * 2;
+    return newCapacity < required ? required : newCapacity;
+}
+
+/*
+ Determines whether a hash map with numUsed slots full or deleted out of numSlots has to grow.
+ Maps are kept at most three quarters full, so a probe sequence always reaches an empty slot quickly.
+ */
+#define coll_map_over_load(numUsed, numSlots) ((numUsed) * 4 > (numSlots) * 3)
+
+/*
+ Mixes the bits of an integer key, so that keys that only differ in their upper bits don't all land together.
+ */
+static inline uint64_t coll_hash_u64(uint64_t key)
+{
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+    return key;
+}
+
+/*
+ FNV-1a hash of length bytes, for keys like strings.
+ */
+uint64_t coll_hash_bytes(const void *bytes, size_t length);
+
+/*
+ Growable array: name { count, capacity, items }.
+ prefix_new(initialCapacity), prefix_reserve(vector, numItems) to make room for numItems more,
+ prefix_push(vector, item), which returns a pointer to where it was stored, prefix_pop(vector, output),
+ prefix_remove(vector, index), which keeps the order of the rest, prefix_shrink(vector) to give back unused capacity,
+ prefix_clear(vector) and prefix_free(vector).
+ Pointers into items are invalidated by anything that grows the vector. The items array comes from malloc,
+ so it can be kept after the vector is done with, and later freed with free.
+ */
+#define CREATE_VECTOR_TYPE(name, prefix, type)                                                             \
+typedef struct name                                                                                        \
+{                                                                                                          \
+    size_t count;                                                                                          \
+    size_t capacity;                                                                                       \
+    type *items;                                                                                           \
+} name;                                                                                                    \
+                                                                                                           \
+static inline name prefix##_new(size_t initialCapacity)                                                    \
+{                                                                                                          \
+    name vector = { .count = 0, .capacity = 0, .items = nullptr };                                         \
+    if (initialCapacity == 0) return vector;                                                               \
+    vector.items = malloc(initialCapacity * sizeof(type));                                                 \
+    if (vector.items != nullptr) vector.capacity = initialCapacity;                                        \
+    return vector;                                                                                         \
+}                                                                                                          \
+                                                                                                           \
+static inline bool prefix##_reserve(name *vector, size_t numItems)                                         \
+{                                                                                                          \
+    if (vector->count + numItems <= vector->capacity) return true;                                         \
+    size_t newCapacity = coll_grow_capacity(vector->capacity, vector->count + numItems);                   \
+    type *newItems = realloc(vector->items, newCapacity * sizeof(type));                                   \
+    if (newItems == nullptr) return false;                                                                 \
+    vector->items = newItems;                                                                              \
+    vector->capacity = newCapacity;                                                                        \
+    return true;                                                                                           \
+}                                                                                                          \
+                                                                                                           \
+static inline type *prefix##_push(name *vector, type item)                                                 \
+{                                                                                                          \
+    if (vector->count == vector->capacity && !prefix##_reserve(vector, 1)) return nullptr;                 \
+    vector->items[vector->count] = item;                                                                   \
+    return &vector->items[vector->count++];                                                                \
+}                                                                                                          \
+                                                                                                           \
+static inline bool prefix##_pop(name *vector, type *output)                                                \
+{                                                                                                          \
+    if (vector->count == 0) return false;                                                                  \
+    vector->count--;                                                                                       \
+    if (output != nullptr) *output = vector->items[vector->count];                                         \
+    return true;                                                                                           \
+}                                                                                                          \
+                                                                                                           \
+static inline void prefix##_remove(name *vector, size_t index)                                             \
+{                                                                                                          \
+    if (index >= vector->count) return;                                                                    \
+    memmove(&vector->items[index], &vector->items[index + 1], (vector->count - index - 1) * sizeof(type)); \
+    vector->count--;                                                                                       \
+}                                                                                                          \
+                                                                                                           \
+static inline void prefix##_shrink(name *vector)                                                           \
+{                                                                                                          \
+    if (vector->count == vector->capacity) return;                                                         \
+    if (vector->count == 0)                                                                                \
+    {                                                                                                      \
+        free(vector->items);                                                                               \
+        vector->items = nullptr;                                                                           \
+        vector->capacity = 0;                                                                              \
+        return;                                                                                            \
+    }                                                                                                      \
+    type *newItems = realloc(vector->items, vector->count * sizeof(type));                                 \
+    if (newItems == nullptr) return;                                                                       \
+    vector->items = newItems;                                                                              \
+    vector->capacity = vector->count;                                                                      \
+}                                                                                                          \
+                                                                                                           \
+static inline void prefix##_clear(name *vector)                                                            \
+{                                                                                                          \
+    vector->count = 0;                                                                                     \
+}                                                                                                          \
+                                                                                                           \
+static inline void prefix##_free(name *vector)                                                             \
+{                                                                                                          \
+    free(vector->items);                                                                                   \
+    *vector = (name) { .count = 0, .capacity = 0, .items = nullptr };                                      \
+}
+
+/*
+ Vector used as a last-in, first-out stack: everything CREATE_VECTOR_TYPE defines, plus prefix_peek(stack),
+ which gets the item on top, or nullptr if there is none.
+ */
+#define CREATE_STACK_TYPE(name, prefix, type)                             \
+CREATE_VECTOR_TYPE(name, prefix, type)                                    \
+                                                                          \
+static inline type *prefix##_peek(name *stack)                            \
+{                                                                         \
+    return stack->count != 0 ? &stack->items[stack->count - 1] : nullptr; \
+}
+
+/*
+ Hash map with open addressing and linear probing: name { count, numUsed, numSlots, slots }, where each slot is a
+ name##Slot { key, state, value }, the state sitting where a small key's padding would be.
+ hashFunction(key) must give a well-mixed integer(see coll_hash_u64 and
+ coll_hash_bytes), and equalFunction(a, b) whether two keys are the same; either may be a function-like macro.
+ prefix_new(expectedCount), prefix_get(map, key), which returns a pointer to the value or nullptr,
+ prefix_put(map, key, value), which adds or replaces the value and returns a pointer to it,
+ prefix_remove(map, key, output), prefix_clear(map) and prefix_free(map).
+ Entries are stored in the slot array itself, so there is no allocation per entry. To go through all of them,
+ look at each of the numSlots slots whose state is COLL_SLOT_FULL.
+ Pointers to values are invalidated by prefix_put adding a key.
+ */
+#define CREATE_HASH_MAP_TYPE(name, prefix, keyType, valueType, hashFunction, equalFunction)   \
+typedef struct name##Slot                                                                     \
+{                                                                                             \
+    keyType key;                                                                              \
+    unsigned char state;                                                                      \
+    valueType value;                                                                          \
+} name##Slot;                                                                                 \
+                                                                                              \
+typedef struct name                                                                           \
+{                                                                                             \
+    size_t count;                                                                             \
+    size_t numUsed;                                                                           \
+    size_t numSlots;                                                                          \
+    name##Slot *slots;                                                                        \
+} name;                                                                                       \
+                                                                                              \
+static inline name prefix##_new(size_t expectedCount)                                         \
+{                                                                                             \
+    name map = { .count = 0, .numUsed = 0, .numSlots = 0, .slots = nullptr };                 \
+    if (expectedCount == 0) return map;                                                       \
+    size_t numSlots = COLL_MAP_MIN_SLOTS;                                                     \
+    while (coll_map_over_load(expectedCount, numSlots)) numSlots *= 2;                        \
+    map.slots = calloc(numSlots, sizeof(name##Slot));                                         \
+    if (map.slots != nullptr) map.numSlots = numSlots;                                        \
+    return map;                                                                               \
+}                                                                                             \
+                                                                                              \
+static inline size_t prefix##_find_slot(const name *map, keyType key)                         \
+{                                                                                             \
+    if (map->numSlots == 0) return SIZE_MAX;                                                  \
+    size_t mask = map->numSlots - 1;                                                          \
+    for (size_t index = (size_t)(hashFunction(key)) & mask;; index = (index + 1) & mask)      \
+    {                                                                                         \
+        const name##Slot *slot = &map->slots[index];                                          \
+        if (slot->state == COLL_SLOT_FULL && equalFunction(slot->key, key)) return index;     \
+        if (slot->state == COLL_SLOT_EMPTY) return SIZE_MAX;                                  \
+    }                                                                                         \
+}                                                                                             \
+                                                                                              \
+static inline bool prefix##_rehash(name *map, size_t numSlots)                                \
+{                                                                                             \
+    name##Slot *newSlots = calloc(numSlots, sizeof(name##Slot));                              \
+    if (newSlots == nullptr) return false;                                                    \
+    size_t mask = numSlots - 1;                                                               \
+    for (size_t i = 0; i < map->numSlots; i++)                                                \
+    {                                                                                         \
+        name##Slot *slot = &map->slots[i];                                                    \
+        if (slot->state != COLL_SLOT_FULL) continue;                                          \
+        size_t index = (size_t)(hashFunction(slot->key)) & mask;                              \
+        while (newSlots[index].state != COLL_SLOT_EMPTY) index = (index + 1) & mask;          \
+        newSlots[index] = *slot;                                                              \
+    }                                                                                         \
+    free(map->slots);                                                                         \
+    map->slots = newSlots;                                                                    \
+    map->numSlots = numSlots;                                                                 \
+    map->numUsed = map->count;                                                                \
+    return true;                                                                              \
+}                                                                                             \
+                                                                                              \
+static inline valueType *prefix##_get(name *map, keyType key)                                 \
+{                                                                                             \
+    size_t index = prefix##_find_slot(map, key);                                              \
+    return index != SIZE_MAX ? &map->slots[index].value : nullptr;                            \
+}                                                                                             \
+                                                                                              \
+static inline valueType *prefix##_put(name *map, keyType key, valueType value)                \
+{                                                                                             \
+    size_t index = prefix##_find_slot(map, key);                                              \
+    if (index != SIZE_MAX)                                                                    \
+    {                                                                                         \
+        map->slots[index].value = value;                                                      \
+        return &map->slots[index].value;                                                      \
+    }                                                                                         \
+    if (map->numSlots == 0 || coll_map_over_load(map->numUsed + 1, map->numSlots))            \
+    {                                                                                         \
+        size_t numSlots = map->numSlots == 0 ? COLL_MAP_MIN_SLOTS : map->numSlots;            \
+        while (coll_map_over_load(map->count + 1, numSlots)) numSlots *= 2;                   \
+        if (!prefix##_rehash(map, numSlots)) return nullptr;                                  \
+    }                                                                                         \
+    size_t mask = map->numSlots - 1;                                                          \
+    index = (size_t)(hashFunction(key)) & mask;                                               \
+    while (map->slots[index].state == COLL_SLOT_FULL) index = (index + 1) & mask;             \
+    if (map->slots[index].state == COLL_SLOT_EMPTY) map->numUsed++;                           \
+    map->slots[index] = (name##Slot) { .key = key, .value = value, .state = COLL_SLOT_FULL }; \
+    map->count++;                                                                             \
+    return &map->slots[index].value;                                                          \
+}                                                                                             \
+                                                                                              \
+static inline bool prefix##_remove(name *map, keyType key, valueType *output)                 \
+{                                                                                             \
+    size_t index = prefix##_find_slot(map, key);                                              \
+    if (index == SIZE_MAX) return false;                                                      \
+    if (output != nullptr) *output = map->slots[index].value;                                 \
+    map->slots[index].state = COLL_SLOT_DELETED;                                              \
+    map->count--;                                                                             \
+    return true;                                                                              \
+}                                                                                             \
+                                                                                              \
+static inline void prefix##_clear(name *map)                                                  \
+{                                                                                             \
+    if (map->slots != nullptr) memset(map->slots, 0, map->numSlots * sizeof(name##Slot));     \
+    map->count = 0;                                                                           \
+    map->numUsed = 0;                                                                         \
+}                                                                                             \
+                                                                                              \
+static inline void prefix##_free(name *map)                                                   \
+{                                                                                             \
+    free(map->slots);                                                                         \
+    *map = (name) { .count = 0, .numUsed = 0, .numSlots = 0, .slots = nullptr };              \
+}
+
+/*
+ First-in, first-out queue in a circular array whose capacity is a power of two: name { head, count, capacity, items }.
+ prefix_new(initialCapacity), prefix_push(ring, item) to add to the back, prefix_peek(ring), which gets the item at the
+ front or nullptr, prefix_pop(ring, output) to take it off and prefix_free(ring).
+ */
+#define CREATE_RING_BUFFER_TYPE(name, prefix, type)                                                                \
+typedef struct name                                                                                                \
+{                                                                                                                  \
+    size_t head;                                                                                                   \
+    size_t count;                                                                                                  \
+    size_t capacity;                                                                                               \
+    type *items;                                                                                                   \
+} name;                                                                                                            \
+                                                                                                                   \
+static inline name prefix##_new(size_t initialCapacity)                                                            \
+{                                                                                                                  \
+    name ring = { .head = 0, .count = 0, .capacity = 0, .items = nullptr };                                        \
+    if (initialCapacity == 0) return ring;                                                                         \
+    size_t capacity = 1;                                                                                           \
+    while (capacity < initialCapacity) capacity *= 2;                                                              \
+    ring.items = malloc(capacity * sizeof(type));                                                                  \
+    if (ring.items != nullptr) ring.capacity = capacity;                                                           \
+    return ring;                                                                                                   \
+}                                                                                                                  \
+                                                                                                                   \
+static inline bool prefix##_grow(name *ring)                                                                       \
+{                                                                                                                  \
+    size_t newCapacity = ring->capacity == 0 ? COLL_MIN_CAPACITY : ring->capacity * 2;                             \
+    type *newItems = realloc(ring->items, newCapacity * sizeof(type));                                             \
+    if (newItems == nullptr) return false;                                                                         \
+    size_t numWrapped = ring->head + ring->count > ring->capacity ? ring->head + ring->count - ring->capacity : 0; \
+    memcpy(&newItems[ring->capacity], newItems, numWrapped * sizeof(type));                                        \
+    ring->items = newItems;                                                                                        \
+    ring->capacity = newCapacity;                                                                                  \
+    return true;                                                                                                   \
+}                                                                                                                  \
+                                                                                                                   \
+static inline bool prefix##_push(name *ring, type item)                                                            \
+{                                                                                                                  \
+    if (ring->count == ring->capacity && !prefix##_grow(ring)) return false;                                       \
+    ring->items[(ring->head + ring->count) & (ring->capacity - 1)] = item;                                         \
+    ring->count++;                                                                                                 \
+    return true;                                                                                                   \
+}                                                                                                                  \
+                                                                                                                   \
+static inline type *prefix##_peek(name *ring)                                                                      \
+{                                                                                                                  \
+    return ring->count != 0 ? &ring->items[ring->head] : nullptr;                                                  \
+}                                                                                                                  \
+                                                                                                                   \
+static inline bool prefix##_pop(name *ring, type *output)                                                          \
+{                                                                                                                  \
+    if (ring->count == 0) return false;                                                                            \
+    if (output != nullptr) *output = ring->items[ring->head];                                                      \
+    ring->head = (ring->head + 1) & (ring->capacity - 1);                                                          \
+    ring->count--;                                                                                                 \
+    return true;                                                                                                   \
+}                                                                                                                  \
+                                                                                                                   \
+static inline void prefix##_free(name *ring)                                                                       \
+{                                                                                                                  \
+    free(ring->items);                                                                                             \
+    *ring = (name) { .head = 0, .count = 0, .capacity = 0, .items = nullptr };                                     \
+}
 
 #endif //GOPHERBROWSER_COLLECTIONS_H
\ No newline at end of file
@@ -0,0 +1,226 @@
+/*
+*  This Source Code Form is subject to the terms of the Mozilla Public
+*  License, v. 2.0. If a copy of the MPL was not distributed with this
+*  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#include "compact-menu.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define CM_INITIAL_CAPACITY 32
+
+//cm_find_type scans the types a byte at a time
+static_assert(sizeof(gopherEntityType) == 1, "gopherEntityType must be a single byte");
+
+compactMenu cm_new()
+{
+    return (compactMenu) { 0 };
+}
+
+//Copies the string into the arena, terminator and all, and returns where it starts. The space must have been reserved.
+static uint32_t cm_add_string(compactMenu *menu, const char *string, size_t length)
+{
+    uint32_t offset = (uint32_t)menu->arena.count;
+    memcpy(rb_tail(&menu->arena), string, length);
+    ((char *)rb_tail(&menu->arena))[length] = '\0';
+    rb_commit(&menu->arena, length + 1);
+    return offset;
+}
+
+//Grows one column to the specified number of elements, leaving it as it was on failure
+static bool cm_grow_column(void **column, size_t capacity, size_t elementSize)
+{
+    void *grown = realloc(*column, capacity * elementSize);
+    if (grown == nullptr) return false;
+    *column = grown;
+    return true;
+}
+
+static bool cm_grow(compactMenu *menu)
+{
+    size_t newCapacity = menu->capacity == 0 ? CM_INITIAL_CAPACITY : menu->capacity * 2;
+    //Columns that did grow stay that way if a later one fails, which is harmless since capacity still covers them all
+    if (!cm_grow_column((void **)&menu->types, newCapacity, sizeof(gopherEntityType))
+        || !cm_grow_column((void **)&menu->ports, newCapacity, sizeof(uint16_t))
+        || !cm_grow_column((void **)&menu->hostIds, newCapacity, sizeof(hostId))
+        || !cm_grow_column((void **)&menu->displayNameOffsets, newCapacity, sizeof(uint32_t))
+        || !cm_grow_column((void **)&menu->selectorOffsets, newCapacity, sizeof(uint32_t))) return false;
+    menu->capacity = newCapacity;
+    return true;
+}
+
+bool cm_append(compactMenu *menu, const gopherEntity *entity)
+{
+    size_t stringBytes = sv_len(entity->displayName) + sv_len(entity->selector) + 2;
+    //Strings are found by 32-bit offsets, so the arena can't go past what they reach
+    if (stringBytes > CM_MAX_STRING_BYTES - menu->arena.count) return false;
+    if (menu->numEntities == menu->capacity && !cm_grow(menu)) return false;
+    if (!rb_reserve(&menu->arena, stringBytes)) return false;
+    size_t index = menu->numEntities++;
+    menu->types[index] = entity->type;
+    menu->ports[index] = entity->port > 0 && entity->port <= UINT16_MAX ? (uint16_t)entity->port : 0;
+    //Entities put together by hand may not have had their host interned
+    menu->hostIds[index] = entity->hostId != HOST_ID_NONE ? entity->hostId
+                                                          : hi_intern_n(sv_str(entity->host), sv_len(entity->host));
+    menu->displayNameOffsets[index] = cm_add_string(menu, sv_str(entity->displayName), sv_len(entity->displayName));
+    menu->selectorOffsets[index] = cm_add_string(menu, sv_str(entity->selector), sv_len(entity->selector));
+    return true;
+}
+
+compactMenu cm_from_menu(const gopherMenu *menu)
+{
+    compactMenu output = cm_new();
+    for (size_t i = 0; i < menu->numEntities; i++)
+    {
+        if (!cm_append(&output, &menu->entities[i])) break;
+        if (menu->entities[i].prefetchedData != nullptr) cm_set_prefetched(&output, i, menu->entities[i].prefetchedData);
+    }
+    return output;
+}
+
+static void cm_append_parsed(gopherEntity *entity, void *userData)
+{
+    cm_append(userData, entity);
+}
+
+compactMenu cm_parse(const char *source, size_t length)
+{
+    compactMenu output = cm_new();
+    gopherMenuParser parser = gopher_menu_parser_new(cm_append_parsed, &output);
+    gopher_menu_parser_feed(&parser, source, length);
+    gopher_menu_parser_finish(&parser);
+    gopher_menu_parser_free(&parser);
+    return output;
+}
+
+const char *cm_display_name(const compactMenu *menu, size_t index)
+{
+    return (const char *)menu->arena.contents + menu->displayNameOffsets[index];
+}
+
+const char *cm_selector(const compactMenu *menu, size_t index)
+{
+    return (const char *)menu->arena.contents + menu->selectorOffsets[index];
+}
+
+const char *cm_host(const compactMenu *menu, size_t index)
+{
+    return hi_str(menu->hostIds[index]);
+}
+
+gopherEntity cm_get_entity(const compactMenu *menu, size_t index)
+{
+    return (gopherEntity)
+    {
+        .type = menu->types[index],
+        .displayName = sv_borrow(cm_display_name(menu, index), strlen(cm_display_name(menu, index))),
+        .selector = sv_borrow(cm_selector(menu, index), strlen(cm_selector(menu, index))),
+        .host = hi_name(menu->hostIds[index]),
+        .hostId = menu->hostIds[index],
+        .port = menu->ports[index],
+        .prefetchedData = cm_get_prefetched(menu, index)
+    };
+}
+
+size_t cm_find_type(const compactMenu *menu, gopherEntityType type, size_t start)
+{
+    if (start >= menu->numEntities) return menu->numEntities;
+    //One byte per entity, so this runs through the types as fast as memchr can go
+    const gopherEntityType *found = memchr(menu->types + start, type, menu->numEntities - start);
+    return found != nullptr ? (size_t)(found - menu->types) : menu->numEntities;
+}
+
+//Gets the position in the side table where the entity's data is, or would go
+static size_t cm_prefetched_position(const compactMenu *menu, size_t index)
+{
+    size_t low = 0, high = menu->numPrefetched;
+    while (low < high)
+    {
+        size_t middle = low + (high - low) / 2;
+        if (menu->prefetchedIndices[middle] < index) low = middle + 1;
+        else high = middle;
+    }
+    return low;
+}
+
+void cm_set_prefetched(compactMenu *menu, size_t index, sharedBuffer *data)
+{
+    size_t position = cm_prefetched_position(menu, index);
+    if (position < menu->numPrefetched && menu->prefetchedIndices[position] == index)
+    {
+        sharedBuffer *previous = menu->prefetchedData[position];
+        menu->prefetchedData[position] = data != nullptr ? srb_ref(data) : nullptr;
+        srb_release(previous);
+        return;
+    }
+    if (data == nullptr) return;
+    if (menu->numPrefetched == menu->prefetchedCapacity)
+    {
+        size_t newCapacity = menu->prefetchedCapacity == 0 ? 8 : menu->prefetchedCapacity * 2;
+        if (!cm_grow_column((void **)&menu->prefetchedIndices, newCapacity, sizeof(uint32_t))
+            || !cm_grow_column((void **)&menu->prefetchedData, newCapacity, sizeof(sharedBuffer *))) return;
+        menu->prefetchedCapacity = newCapacity;
+    }
+    size_t toMove = menu->numPrefetched - position;
+    memmove(menu->prefetchedIndices + position + 1, menu->prefetchedIndices + position, toMove * sizeof(uint32_t));
+    memmove(menu->prefetchedData + position + 1, menu->prefetchedData + position, toMove * sizeof(sharedBuffer *));
+    menu->prefetchedIndices[position] = (uint32_t)index;
+    menu->prefetchedData[position] = srb_ref(data);
+    menu->numPrefetched++;
+}
+
+sharedBuffer *cm_get_prefetched(const compactMenu *menu, size_t index)
+{
+    size_t position = cm_prefetched_position(menu, index);
+    if (position < menu->numPrefetched && menu->prefetchedIndices[position] == index) return menu->prefetchedData[position];
+    return nullptr;
+}
+
+size_t cm_memory_usage(const compactMenu *menu)
+{
+    size_t perEntity = sizeof(gopherEntityType) + sizeof(uint16_t) + sizeof(hostId) + 2 * sizeof(uint32_t);
+    return menu->capacity * perEntity + menu->arena.capacity
+           + menu->prefetchedCapacity * (sizeof(uint32_t) + sizeof(sharedBuffer *));
+}
+
+const compactMenu *cm_move_to_arena(compactMenu *menu, memArena *arena)
+{
+    for (size_t i = 0; i < menu->numPrefetched; i++)
+    {
+        srb_release(menu->prefetchedData[i]);
+    }
+    free(menu->prefetchedIndices);
+    free(menu->prefetchedData);
+    menu->numPrefetched = 0;
+    menu->prefetchedCapacity = 0;
+    menu->prefetchedIndices = nullptr;
+    menu->prefetchedData = nullptr;
+    //Every column is handed over even if one fails, so each ends up either in the arena or freed
+    bool adopted = ma_adopt(arena, menu->types);
+    adopted &= ma_adopt(arena, menu->ports);
+    adopted &= ma_adopt(arena, menu->hostIds);
+    adopted &= ma_adopt(arena, menu->displayNameOffsets);
+    adopted &= ma_adopt(arena, menu->selectorOffsets);
+    adopted &= ma_adopt(arena, menu->arena.contents);
+    compactMenu *moved = adopted ? ma_add(arena, menu, sizeof(compactMenu)) : nullptr;
+    *menu = cm_new();
+    return moved;
+}
+
+void cm_free(compactMenu *menu)
+{
+    for (size_t i = 0; i < menu->numPrefetched; i++)
+    {
+        srb_release(menu->prefetchedData[i]);
+    }
+    free(menu->types);
+    free(menu->ports);
+    free(menu->hostIds);
+    free(menu->displayNameOffsets);
+    free(menu->selectorOffsets);
+    free(menu->prefetchedIndices);
+    free(menu->prefetchedData);
+    rb_free(&menu->arena);
+    *menu = cm_new();
+}
\ No newline at end of file
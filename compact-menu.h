@@ -0,0 +1,114 @@
+/*
+*  This Source Code Form is subject to the terms of the Mozilla Public
+*  License, v. 2.0. If a copy of the MPL was not distributed with this
+*  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#ifndef GOPHERBROWSER_COMPACT_MENU_H
+#define GOPHERBROWSER_COMPACT_MENU_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "buffer-utils.h"
+#include "gopher-protocol.h"
+#include "host-intern.h"
+
+//The most the strings of a compactMenu, terminators included, can take up together
+#define CM_MAX_STRING_BYTES ((size_t)UINT32_MAX)
+
+/*
+ Column-oriented Gopher menu for large directories. Each field of the entities is kept in an array of its own,
+ so a scan over one of them(e.g. looking for images by type) doesn't drag the rest through the cache.
+ Strings are packed one after another into a single arena and referred to by offset, which limits them to
+ CM_MAX_STRING_BYTES in all, hosts are kept as their interned ids, and the few entities with prefetched data keep it
+ in a side table.
+ Should be created with cm_new, cm_from_menu or cm_parse, and freed with cm_free.
+ */
+typedef struct compactMenu
+{
+    size_t numEntities;
+    size_t capacity;
+    gopherEntityType *types;
+    uint16_t *ports; //0 if the menu gave a port that doesn't fit
+    hostId *hostIds;
+    uint32_t *displayNameOffsets; //Offsets of null-terminated strings in the arena
+    uint32_t *selectorOffsets;
+    resizableBuffer arena;
+    size_t numPrefetched; //Sorted by entity index
+    size_t prefetchedCapacity;
+    uint32_t *prefetchedIndices;
+    sharedBuffer **prefetchedData;
+} compactMenu;
+
+/*
+ Creates an empty compactMenu.
+ */
+compactMenu cm_new();
+
+/*
+ Creates a compactMenu holding copies of every entity in the menu. Prefetched data is shared, not copied.
+ If memory runs out, the entities that did fit are kept.
+ */
+compactMenu cm_from_menu(const gopherMenu *menu);
+
+/*
+ Creates a compactMenu from the given source text, without building a gopherMenu along the way.
+ */
+compactMenu cm_parse(const char *source, size_t length);
+
+/*
+ Adds a copy of the entity to the end of the menu. Its prefetched data, if any, is not included.
+ Strings previously returned for this menu may move. Returns false, leaving the menu as it was, if it couldn't grow
+ or its strings would no longer fit in CM_MAX_STRING_BYTES.
+ */
+bool cm_append(compactMenu *menu, const gopherEntity *entity);
+
+const char *cm_display_name(const compactMenu *menu, size_t index);
+const char *cm_selector(const compactMenu *menu, size_t index);
+const char *cm_host(const compactMenu *menu, size_t index);
+#define cm_type(_menu, _index) ((_menu)->types[_index])
+#define cm_port(_menu, _index) ((int)(_menu)->ports[_index])
+#define cm_host_id(_menu, _index) ((_menu)->hostIds[_index])
+
+/*
+ Gets a gopherEntity view of the entity at the specified index, whose strings point into the menu.
+ It must not be freed, and is only valid until the menu is next modified.
+ */
+gopherEntity cm_get_entity(const compactMenu *menu, size_t index);
+
+/*
+ Finds the first entity of the specified type at or after start.
+ Returns menu->numEntities if there isn't one.
+ */
+size_t cm_find_type(const compactMenu *menu, gopherEntityType type, size_t start);
+
+/*
+ Attaches prefetched data to the entity at the specified index, taking a reference to it
+ and releasing whatever was attached before.
+ */
+void cm_set_prefetched(compactMenu *menu, size_t index, sharedBuffer *data);
+
+/*
+ Gets the prefetched data attached to the entity at the specified index, or nullptr if there isn't any.
+ */
+sharedBuffer *cm_get_prefetched(const compactMenu *menu, size_t index);
+
+/*
+ Gets the number of bytes of heap memory the menu is using, not counting prefetched data.
+ */
+size_t cm_memory_usage(const compactMenu *menu);
+
+/*
+ Hands the menu's memory over to the arena, which frees it when it's reset, and moves the menu itself into the arena.
+ Prefetched data isn't carried over; it's released straight away. The moved menu is read-only, must not be freed
+ with cm_free, and is valid until the arena is reset. The original is left empty.
+ Returns nullptr if the arena couldn't grow, in which case the menu's memory is gone.
+ */
+const compactMenu *cm_move_to_arena(compactMenu *menu, memArena *arena);
+
+/*
+ Frees the heap memory associated with a compactMenu, releasing its prefetched data.
+ */
+void cm_free(compactMenu *menu);
+
+#endif //GOPHERBROWSER_COMPACT_MENU_H
\ No newline at end of file
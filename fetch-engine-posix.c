@@ -0,0 +1,1302 @@
+/*
+*  This Source Code Form is subject to the terms of the Mozilla Public
+*  License, v. 2.0. If a copy of the MPL was not distributed with this
+*  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#include "fetch-engine.h"
+#include "resolver.h"
+#include "host-intern.h"
+#include "buffer-pool.h"
+#include "string_utils.h"
+
+//The engine is built on epoll, so for now it is Linux-only.
+//A kqueue backend would be needed for the BSDs and macOS.
+#if defined(__linux__)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <threads.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#define FE_MAX_EVENTS 64
+//Number of buckets in the table of in-flight transactions. Must be a power of two.
+#define FE_IN_FLIGHT_BUCKETS 256
+//Number of buckets in the table of per-host queues. Must be a power of two.
+#define FE_HOST_BUCKETS 64
+#define NS_PER_MS 1000000ULL
+
+enum fetchState
+{
+    FETCH_STATE_RESOLVING,
+    FETCH_STATE_QUEUED,
+    FETCH_STATE_CONNECTING,
+    FETCH_STATE_SENDING,
+    FETCH_STATE_RECEIVING,
+    FETCH_STATE_DONE
+};
+
+/*
+ One socket belonging to a request. Every descriptor registered with epoll carries a pointer to one of these,
+ since a request may be racing several connection attempts at once.
+ */
+struct connectAttempt
+{
+    struct fetchRequest *request;
+    int sock; //-1 when not in use
+};
+
+/*
+ An idle socket connected ahead of time, waiting for a transaction to the warm host to pick it up.
+ */
+struct warmSocket
+{
+    struct connectAttempt attempt; //Its request is always nullptr, which is how epoll events for it are told apart
+    uint64_t generation; //Of the warm target it was opened for
+    bool connected;
+    uint64_t connectStart;
+    uint64_t connectEnd;
+};
+
+/*
+ Scheduling state for one host: the requests waiting to connect to it, one queue per priority,
+ and how many are connected already.
+ Exists only while the host has requests queued or active. Protected by the engine's mutex.
+ */
+struct fetchHost
+{
+    hostId id;
+    size_t numActive;
+    struct fetchRequest *queueHead[FETCH_PRIORITY_COUNT];
+    struct fetchRequest *queueTail[FETCH_PRIORITY_COUNT];
+    bool ready[FETCH_PRIORITY_COUNT]; //Whether the host is in the engine's round-robin list for each priority
+    struct fetchHost *nextReady[FETCH_PRIORITY_COUNT];
+    struct fetchHost *nextInTable;
+};
+
+struct fetchRequest
+{
+    atomic_int refCount;
+    enum fetchState state;
+    fetchStatus status;
+    hostId host;
+    int port;
+    stringBuilder message; //Selector followed by CRLF, exactly as it goes on the wire
+    size_t bytesSent;
+    dnsFuture *dns;
+    addrList addrs; //In the order they will be tried
+    size_t nextAddr; //Index of the next address to start a connection attempt to
+    size_t numAttempts; //Connection attempts currently in progress
+    uint64_t nextAttemptAt; //When to start another attempt if none has succeeded by then, or 0
+    struct connectAttempt attempts[ADDR_CACHE_MAX_ADDRS]; //Indexed the same way as addrs
+    struct connectAttempt *connection; //The attempt that won, once one has
+    int lastConnectError; //errno from the most recent failed attempt
+    fetchTiming timing;
+    int sock;
+    bool active; //Whether the request is counted against maxActive and its host's limit
+    struct fetchHost *scheduledHost; //Set while the request is queued or active
+    fetchPriority priority; //What the submitter asked for
+    fetchPriority queuedPriority; //What the request is scheduled as, which may be raised by followers that need it sooner
+    resizableBuffer response; //Data received so far, while the transaction is running
+    sharedBuffer *result; //The finished response, shared with any duplicates of the transaction
+    fetchCallback onComplete;
+    void *userData;
+    fetchCancelToken *cancelToken;
+    fetchOptions options;
+    uint64_t totalDeadline; //Monotonic time in nanoseconds, or 0 for none
+    uint64_t phaseDeadline; //Deadline for the connect or first byte, whichever we're waiting on
+    bool finishing; //Set once the request has been handed to fe_complete, so nothing else tries to
+    uint64_t keyHash; //Hash of the host, port, selector and cancellation token
+    struct fetchRequest *nextInFlight; //Link in the engine's table of transactions that duplicates can join
+    struct fetchRequest *followers; //Duplicate requests waiting on this one's transfer
+    struct fetchRequest *nextFollower;
+    struct fetchRequest *leader; //The request a follower is waiting on, until it finishes
+    struct fetchRequest *next; //Link in the engine's submission queue
+    struct fetchRequest *prevLive; //Links in the list of every request that hasn't finished yet
+    struct fetchRequest *nextLive;
+    struct fetchRequest *nextDue; //Link in lists the I/O thread builds up while walking the live list
+    struct fetchRequest *nextRelease; //Link in the list of requests to release at the end of the I/O loop iteration
+};
+
+struct fetchCancelToken
+{
+    atomic_int refCount;
+    atomic_bool cancelled;
+};
+
+static struct
+{
+    once_flag initFlag;
+    mtx_t mutex;
+    cnd_t completed;
+    thrd_t thread;
+    int epollFd;
+    int wakeFd;
+    size_t maxActive;
+    size_t maxPerHost;
+    size_t numActive;
+    size_t socketBudget; //How many descriptors we can have open before we risk running the process out of them
+    size_t maxSockets; //socketBudget, or fewer for as long as the process has run out of descriptors anyway
+    size_t numSockets; //Only touched by the I/O thread
+    struct fetchHost *hosts[FE_HOST_BUCKETS];
+    //Hosts with queued requests and room for another connection, one list per priority.
+    //Higher priorities are always served first, and the hosts within each are served round-robin
+    //so no host can starve another.
+    struct fetchHost *readyHead[FETCH_PRIORITY_COUNT];
+    struct fetchHost *readyTail[FETCH_PRIORITY_COUNT];
+    fetchRequest *live;
+    fetchRequest *inFlight[FE_IN_FLIGHT_BUCKETS];
+    fetchRequest *releaseList; //Only touched by the I/O thread
+    //What fe_warm_host last asked for
+    struct
+    {
+        hostId host; //HOST_ID_NONE when nothing is to be kept warm
+        int port;
+        size_t count;
+        bool resolved;
+        addrList addrs; //In the order they would be tried, once resolved
+        uint64_t deadline; //When the pool's sockets are closed and it stops replacing them
+        uint64_t generation; //Changes along with the host, so sockets opened for an earlier one can be recognized
+    } warmTarget;
+    struct warmSocket warmSockets[FE_WARM_POOL_MAX]; //Only touched by the I/O thread
+} fetchEngine = { .initFlag = ONCE_FLAG_INIT };
+
+static int fe_thread_main([[maybe_unused]] void *arg);
+
+static void fe_init()
+{
+    mtx_init(&fetchEngine.mutex, mtx_plain);
+    cnd_init(&fetchEngine.completed);
+    fetchEngine.maxActive = FE_DEFAULT_MAX_ACTIVE;
+    fetchEngine.maxPerHost = FE_DEFAULT_MAX_PER_HOST;
+    for (size_t i = 0; i < FE_WARM_POOL_MAX; i++)
+    {
+        fetchEngine.warmSockets[i].attempt.sock = -1;
+    }
+    //Leave some descriptors for the rest of the program, and never plan on more than we're allowed
+    struct rlimit fileLimit;
+    fetchEngine.socketBudget = SIZE_MAX;
+    if (getrlimit(RLIMIT_NOFILE, &fileLimit) == 0 && fileLimit.rlim_cur != RLIM_INFINITY)
+    {
+        fetchEngine.socketBudget = fileLimit.rlim_cur > FE_RESERVED_FDS * 2 ? fileLimit.rlim_cur - FE_RESERVED_FDS
+                                                                            : fileLimit.rlim_cur / 2;
+    }
+    fetchEngine.maxSockets = fetchEngine.socketBudget;
+    if (fetchEngine.maxActive > fetchEngine.maxSockets) fetchEngine.maxActive = fetchEngine.maxSockets;
+    fetchEngine.epollFd = epoll_create1(EPOLL_CLOEXEC);
+    fetchEngine.wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    //The wakeup descriptor is registered with a null pointer so it can be told apart from requests
+    struct epoll_event event = { .events = EPOLLIN, .data.ptr = nullptr };
+    epoll_ctl(fetchEngine.epollFd, EPOLL_CTL_ADD, fetchEngine.wakeFd, &event);
+    thrd_create(&fetchEngine.thread, fe_thread_main, nullptr);
+    thrd_detach(fetchEngine.thread);
+}
+
+static void fe_wake()
+{
+    uint64_t one = 1;
+    write(fetchEngine.wakeFd, &one, sizeof(one));
+}
+
+//Gets the time timeoutMs milliseconds from now, or 0 if there's no timeout
+static uint64_t fe_deadline_after(unsigned int timeoutMs)
+{
+    return timeoutMs == 0 ? 0 : ft_now() + timeoutMs * NS_PER_MS;
+}
+
+fetchCancelToken *fe_cancel_token_new()
+{
+    fetchCancelToken *token = calloc(1, sizeof(fetchCancelToken));
+    atomic_init(&token->refCount, 1);
+    atomic_init(&token->cancelled, false);
+    return token;
+}
+
+fetchCancelToken *fe_cancel_token_ref(fetchCancelToken *token)
+{
+    if (token != nullptr) atomic_fetch_add(&token->refCount, 1);
+    return token;
+}
+
+void fe_cancel_token_release(fetchCancelToken *token)
+{
+    if (token == nullptr) return;
+    if (atomic_fetch_sub(&token->refCount, 1) == 1) free(token);
+}
+
+void fe_cancel(fetchCancelToken *token)
+{
+    if (token == nullptr) return;
+    call_once(&fetchEngine.initFlag, fe_init);
+    token->cancelled = true;
+    fe_wake(); //The I/O thread notices on its next pass over the live requests
+}
+
+bool fe_is_cancelled(fetchCancelToken *token)
+{
+    return token != nullptr && token->cancelled;
+}
+
+//Takes the request out of the live list. The engine mutex must be held.
+static void fe_unlink_live(fetchRequest *request)
+{
+    if (request->prevLive != nullptr) request->prevLive->nextLive = request->nextLive;
+    else if (fetchEngine.live == request) fetchEngine.live = request->nextLive;
+    else return; //Not in the list
+    if (request->nextLive != nullptr) request->nextLive->prevLive = request->prevLive;
+    request->prevLive = nullptr;
+    request->nextLive = nullptr;
+}
+
+//FNV-1a over everything that has to match for two requests to share a transfer
+static uint64_t fe_key_hash(hostId host, int port, const char *message, const fetchCancelToken *cancelToken)
+{
+    uint64_t hash = (14695981039346656037ULL ^ host) * 1099511628211ULL;
+    for (const unsigned char *c = (const unsigned char *)message; *c != '\0'; c++)
+    {
+        hash = (hash ^ *c) * 1099511628211ULL;
+    }
+    hash = (hash ^ (uint64_t)port) * 1099511628211ULL;
+    return (hash ^ (uint64_t)(uintptr_t)cancelToken) * 1099511628211ULL;
+}
+
+//Finds a running transaction the request could share. The engine's mutex must be held.
+static fetchRequest *fe_find_in_flight(const fetchRequest *request)
+{
+    for (fetchRequest *other = fetchEngine.inFlight[request->keyHash & (FE_IN_FLIGHT_BUCKETS - 1)]; other != nullptr;
+         other = other->nextInFlight)
+    {
+        if (other->keyHash == request->keyHash && other->port == request->port
+            && other->cancelToken == request->cancelToken && other->host == request->host
+            && strcmp(other->message.contents, request->message.contents) == 0)
+            return other;
+    }
+    return nullptr;
+}
+
+//The engine's mutex must be held
+static void fe_unlink_in_flight(fetchRequest *request)
+{
+    for (fetchRequest **link = &fetchEngine.inFlight[request->keyHash & (FE_IN_FLIGHT_BUCKETS - 1)]; *link != nullptr;
+         link = &(*link)->nextInFlight)
+    {
+        if (*link == request)
+        {
+            *link = request->nextInFlight;
+            request->nextInFlight = nullptr;
+            return;
+        }
+    }
+}
+
+/*
+ Claims the request for completion, so that nothing else tries to finish it and no new duplicates join it.
+ The engine's mutex must be held.
+ */
+static void fe_mark_finishing(fetchRequest *request)
+{
+    request->finishing = true;
+    fe_unlink_live(request);
+    fe_unlink_in_flight(request);
+}
+
+static void fe_request_free(fetchRequest *request)
+{
+    fe_cancel_token_release(request->cancelToken);
+    sb_free(&request->message);
+    bp_return(&request->response);
+    srb_release(request->result);
+    free(request);
+}
+
+void fe_release(fetchRequest *request)
+{
+    if (request == nullptr) return;
+    if (atomic_fetch_sub(&request->refCount, 1) == 1) fe_request_free(request);
+}
+
+//Finds the scheduling state for the host, creating it if there is none. The engine's mutex must be held.
+static struct fetchHost *fe_get_host(hostId id)
+{
+    //Host ids are handed out in sequence, so they index the buckets evenly as they are
+    struct fetchHost **bucket = &fetchEngine.hosts[id & (FE_HOST_BUCKETS - 1)];
+    for (struct fetchHost *host = *bucket; host != nullptr; host = host->nextInTable)
+    {
+        if (host->id == id) return host;
+    }
+    struct fetchHost *host = calloc(1, sizeof(struct fetchHost));
+    host->id = id;
+    host->nextInTable = *bucket;
+    *bucket = host;
+    return host;
+}
+
+//Frees the host's state once nothing is queued for or connected to it. The engine's mutex must be held.
+static void fe_put_host(struct fetchHost *host)
+{
+    if (host->numActive > 0) return;
+    for (fetchPriority priority = 0; priority < FETCH_PRIORITY_COUNT; priority++)
+    {
+        if (host->queueHead[priority] != nullptr || host->ready[priority]) return;
+    }
+    for (struct fetchHost **link = &fetchEngine.hosts[host->id & (FE_HOST_BUCKETS - 1)]; *link != nullptr;
+         link = &(*link)->nextInTable)
+    {
+        if (*link == host)
+        {
+            *link = host->nextInTable;
+            break;
+        }
+    }
+    free(host);
+}
+
+/*
+ Puts the host at the back of the round-robin list of each priority it has work waiting at, if it has room to start it.
+ The engine's mutex must be held.
+ */
+static void fe_make_ready(struct fetchHost *host)
+{
+    if (host->numActive >= fetchEngine.maxPerHost) return;
+    for (fetchPriority priority = 0; priority < FETCH_PRIORITY_COUNT; priority++)
+    {
+        if (host->ready[priority] || host->queueHead[priority] == nullptr) continue;
+        host->ready[priority] = true;
+        host->nextReady[priority] = nullptr;
+        if (fetchEngine.readyTail[priority] == nullptr) fetchEngine.readyHead[priority] = host;
+        else fetchEngine.readyTail[priority]->nextReady[priority] = host;
+        fetchEngine.readyTail[priority] = host;
+    }
+}
+
+//Adds the request to the back of its host's queue for its priority. The engine's mutex must be held.
+static void fe_schedule(fetchRequest *request)
+{
+    struct fetchHost *host = request->scheduledHost != nullptr ? request->scheduledHost : fe_get_host(request->host);
+    fetchPriority priority = request->queuedPriority;
+    request->scheduledHost = host;
+    request->next = nullptr;
+    if (host->queueTail[priority] == nullptr) host->queueHead[priority] = request;
+    else host->queueTail[priority]->next = request;
+    host->queueTail[priority] = request;
+    fe_make_ready(host);
+}
+
+//Takes a queued request back out of its host's queue. The engine's mutex must be held.
+static void fe_unschedule(fetchRequest *request)
+{
+    struct fetchHost *host = request->scheduledHost;
+    fetchPriority priority = request->queuedPriority;
+    fetchRequest *previous = nullptr;
+    for (fetchRequest *current = host->queueHead[priority]; current != nullptr; previous = current, current = current->next)
+    {
+        if (current != request) continue;
+        if (previous == nullptr) host->queueHead[priority] = request->next;
+        else previous->next = request->next;
+        if (host->queueTail[priority] == request) host->queueTail[priority] = previous;
+        request->next = nullptr;
+        return;
+    }
+}
+
+//Works out how urgently the request's transfer is needed, counting any followers waiting on it
+static fetchPriority fe_effective_priority(const fetchRequest *request)
+{
+    fetchPriority priority = request->priority;
+    for (const fetchRequest *follower = request->followers; follower != nullptr; follower = follower->nextFollower)
+    {
+        if (follower->priority < priority) priority = follower->priority;
+    }
+    return priority;
+}
+
+/*
+ Moves the request to the queue for its effective priority, if it is still waiting for a connection slot.
+ Requests that are still resolving just pick the new priority up when they're queued. The engine's mutex must be held.
+ */
+static void fe_reschedule(fetchRequest *request)
+{
+    fetchPriority priority = fe_effective_priority(request);
+    if (priority == request->queuedPriority) return;
+    bool queued = request->state == FETCH_STATE_QUEUED && !request->active && !request->finishing
+            && request->scheduledHost != nullptr;
+    if (queued) fe_unschedule(request);
+    request->queuedPriority = priority;
+    if (queued) fe_schedule(request);
+}
+
+/*
+ Queues a request whose lookup has finished, with the addresses it found(nullptr if it failed) and when it finished.
+ They're only stored here, under the lock, since the I/O thread may be completing the request at the same time.
+ */
+static void fe_enqueue(fetchRequest *request, fetchStatus status, const addrList *addrs, uint64_t dnsEnd)
+{
+    mtx_lock(&fetchEngine.mutex);
+    request->dns = nullptr;
+    if (request->finishing) //Timed out or cancelled while we were resolving
+    {
+        mtx_unlock(&fetchEngine.mutex);
+        fe_release(request);
+        return;
+    }
+    request->timing.dnsEnd = dnsEnd;
+    if (addrs != nullptr) request->addrs = *addrs;
+    request->state = FETCH_STATE_QUEUED;
+    request->status = status;
+    fe_schedule(request);
+    mtx_unlock(&fetchEngine.mutex);
+    fe_wake();
+}
+
+/*
+ Orders the addresses the way RFC 8305 section 4 describes: alternating between address families,
+ starting with the family that last worked for this host, or failing that whatever the resolver listed first.
+ */
+static void order_addrs_for_connect(addrList *addrs, int port)
+{
+    if (addrs->count == 0) return;
+    int firstFamily = addrs->addrs[0].addr.ss_family;
+    for (size_t i = 0; i < addrs->count; i++)
+    {
+        if (addrs->addrs[i].addr.ss_family == addrs->preferredFamily) firstFamily = addrs->preferredFamily;
+    }
+    resolvedAddr primary[ADDR_CACHE_MAX_ADDRS], secondary[ADDR_CACHE_MAX_ADDRS];
+    size_t numPrimary = 0, numSecondary = 0;
+    for (size_t i = 0; i < addrs->count; i++)
+    {
+        if (addrs->addrs[i].addr.ss_family == firstFamily) primary[numPrimary++] = addrs->addrs[i];
+        else secondary[numSecondary++] = addrs->addrs[i];
+    }
+    size_t count = 0;
+    for (size_t i = 0; i < numPrimary || i < numSecondary; i++)
+    {
+        if (i < numPrimary) addrs->addrs[count++] = primary[i];
+        if (i < numSecondary) addrs->addrs[count++] = secondary[i];
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        resolved_addr_set_port(&addrs->addrs[i], port);
+    }
+}
+
+//Runs on whichever thread finished the lookup, or on the submitting thread for cached hosts
+static void fe_resolved(dnsFuture *future, void *userData)
+{
+    fetchRequest *request = userData;
+    addrList addrs;
+    fetchStatus status = FETCH_PENDING;
+    uint64_t dnsEnd = ft_now();
+    bool resolved = dns_future_result(future, &addrs);
+    if (resolved) order_addrs_for_connect(&addrs, request->port); //host and port never change, so they're safe to read
+    else
+    {
+        fprintf(stderr, "Could not resolve host %s\n", hi_str(request->host));
+        status = FETCH_ERROR_RESOLVE;
+    }
+    dns_future_release(future);
+    fe_enqueue(request, status, resolved ? &addrs : nullptr, dnsEnd); //Hands the lookup's reference over to the queue
+}
+
+fetchRequest *fe_submit_ex(const char *host, const char *selector, int port, const fetchOptions *options,
+                           fetchCallback onComplete, void *userData)
+{
+    call_once(&fetchEngine.initFlag, fe_init);
+    fetchRequest *request = calloc(1, sizeof(fetchRequest));
+    //One reference each for the caller, the engine and the pending lookup(which passes it on to the queue)
+    atomic_init(&request->refCount, 3);
+    request->state = FETCH_STATE_RESOLVING;
+    request->status = FETCH_PENDING;
+    request->host = hi_intern(host);
+    request->port = port;
+    request->timing.start = ft_now();
+    request->sock = -1;
+    for (size_t i = 0; i < ADDR_CACHE_MAX_ADDRS; i++)
+    {
+        request->attempts[i].sock = -1;
+    }
+    request->onComplete = onComplete;
+    request->userData = userData;
+    request->options = options != nullptr ? *options : FETCH_OPTIONS_DEFAULT;
+    request->priority = request->options.priority < FETCH_PRIORITY_COUNT ? request->options.priority : FETCH_PRIORITY_SPECULATIVE;
+    request->queuedPriority = request->priority;
+    request->cancelToken = fe_cancel_token_ref(request->options.cancelToken);
+    request->totalDeadline = fe_deadline_after(request->options.totalTimeoutMs);
+    request->message = sb_new_with_contents(selector);
+#ifdef EXPERIMENTAL_GOPHER_PLUS
+    sb_append_contents(&request->message, "\t+");
+#endif
+    sb_append_contents(&request->message, "\r\n");
+    request->keyHash = fe_key_hash(request->host, port, request->message.contents, request->cancelToken);
+
+    //A streaming request's chunks are only delivered to it, so it can neither follow nor lead
+    bool streaming = request->options.onChunk != nullptr;
+    mtx_lock(&fetchEngine.mutex);
+    fetchRequest *leader = streaming ? nullptr : fe_find_in_flight(request);
+    if (leader != nullptr)
+    {
+        //Somebody is already fetching exactly this, so wait for their transfer rather than starting another.
+        //A follower has no lookup, socket or deadlines of its own; it finishes whenever the leader does.
+        atomic_store(&request->refCount, 2); //The caller's and the engine's
+        request->nextFollower = leader->followers;
+        leader->followers = request;
+        request->leader = leader;
+        fe_reschedule(leader); //We may need it sooner than whoever started it
+        mtx_unlock(&fetchEngine.mutex);
+#ifdef ROWER_NETWORK_DEBUG
+        fprintf(stderr, "Joining in-flight request for %s:%d%s\n", host, port, selector);
+#endif
+        return request;
+    }
+    if (!streaming)
+    {
+        request->nextInFlight = fetchEngine.inFlight[request->keyHash & (FE_IN_FLIGHT_BUCKETS - 1)];
+        fetchEngine.inFlight[request->keyHash & (FE_IN_FLIGHT_BUCKETS - 1)] = request;
+    }
+    request->nextLive = fetchEngine.live;
+    if (fetchEngine.live != nullptr) fetchEngine.live->prevLive = request;
+    fetchEngine.live = request;
+    mtx_unlock(&fetchEngine.mutex);
+    //Make sure the I/O thread accounts for our deadline when it decides how long to sleep
+    if (request->totalDeadline != 0 || request->cancelToken != nullptr) fe_wake();
+
+    //The lookup runs on the resolver's threads, and the request only joins the engine's queue once it has an address
+    request->dns = resolve_async_id(request->host);
+    dns_future_on_ready(request->dns, fe_resolved, request);
+    return request;
+}
+
+fetchRequest *fe_submit(const char *host, const char *selector, int port, fetchCallback onComplete, void *userData)
+{
+    return fe_submit_ex(host, selector, port, nullptr, onComplete, userData);
+}
+
+void fe_wait(fetchRequest *request)
+{
+    mtx_lock(&fetchEngine.mutex);
+    while (request->state != FETCH_STATE_DONE) cnd_wait(&fetchEngine.completed, &fetchEngine.mutex);
+    mtx_unlock(&fetchEngine.mutex);
+}
+
+fetchStatus fe_status(fetchRequest *request)
+{
+    mtx_lock(&fetchEngine.mutex);
+    fetchStatus status = request->status;
+    mtx_unlock(&fetchEngine.mutex);
+    return status;
+}
+
+resizableBuffer fe_take_result(fetchRequest *request)
+{
+    mtx_lock(&fetchEngine.mutex);
+    sharedBuffer *result = request->result;
+    request->result = nullptr;
+    mtx_unlock(&fetchEngine.mutex);
+    return srb_take(result);
+}
+
+sharedBuffer *fe_share_result(fetchRequest *request)
+{
+    mtx_lock(&fetchEngine.mutex);
+    sharedBuffer *result = srb_ref(request->result);
+    mtx_unlock(&fetchEngine.mutex);
+    return result;
+}
+
+fetchTiming fe_timing(fetchRequest *request)
+{
+    mtx_lock(&fetchEngine.mutex);
+    fetchTiming output = request->timing;
+    mtx_unlock(&fetchEngine.mutex);
+    return output;
+}
+
+void fe_set_max_active(size_t maxActive)
+{
+    call_once(&fetchEngine.initFlag, fe_init);
+    mtx_lock(&fetchEngine.mutex);
+    fetchEngine.maxActive = maxActive > 0 ? maxActive : 1;
+    mtx_unlock(&fetchEngine.mutex);
+    fe_wake();
+}
+
+void fe_set_priority(fetchRequest *request, fetchPriority priority)
+{
+    if (priority >= FETCH_PRIORITY_COUNT) return;
+    mtx_lock(&fetchEngine.mutex);
+    request->priority = priority;
+    fe_reschedule(request->leader != nullptr ? request->leader : request);
+    mtx_unlock(&fetchEngine.mutex);
+    fe_wake();
+}
+
+static void fe_warm_resolved(dnsFuture *future, void *userData)
+{
+    uint64_t generation = (uint64_t)(uintptr_t)userData;
+    addrList addrs;
+    bool resolved = dns_future_result(future, &addrs);
+    dns_future_release(future);
+    if (!resolved) return;
+    mtx_lock(&fetchEngine.mutex);
+    //The target may have moved on while we were waiting
+    if (fetchEngine.warmTarget.generation == generation)
+    {
+        order_addrs_for_connect(&addrs, fetchEngine.warmTarget.port);
+        fetchEngine.warmTarget.addrs = addrs;
+        fetchEngine.warmTarget.resolved = true;
+    }
+    mtx_unlock(&fetchEngine.mutex);
+    fe_wake();
+}
+
+void fe_warm_host(const char *host, int port, size_t count)
+{
+    call_once(&fetchEngine.initFlag, fe_init);
+    if (count > FE_WARM_POOL_MAX) count = FE_WARM_POOL_MAX;
+    hostId id = host != nullptr && count > 0 ? hi_intern(host) : HOST_ID_NONE;
+    mtx_lock(&fetchEngine.mutex);
+    bool sameTarget = id != HOST_ID_NONE && fetchEngine.warmTarget.host == id && fetchEngine.warmTarget.port == port;
+    if (!sameTarget)
+    {
+        fetchEngine.warmTarget.host = id;
+        fetchEngine.warmTarget.port = port;
+        fetchEngine.warmTarget.resolved = false;
+        fetchEngine.warmTarget.generation++;
+    }
+    fetchEngine.warmTarget.count = count;
+    fetchEngine.warmTarget.deadline = ft_now() + FE_WARM_IDLE_TIMEOUT_MS * NS_PER_MS;
+    uint64_t generation = fetchEngine.warmTarget.generation;
+    mtx_unlock(&fetchEngine.mutex);
+    if (!sameTarget && id != HOST_ID_NONE)
+    {
+        //Usually the host of the page that was just loaded, so this is answered from the cache
+        dnsFuture *lookup = resolve_async_id(id);
+        dns_future_on_ready(lookup, fe_warm_resolved, (void *)(uintptr_t)generation);
+    }
+    fe_wake();
+}
+
+void fe_set_max_per_host(size_t maxPerHost)
+{
+    call_once(&fetchEngine.initFlag, fe_init);
+    mtx_lock(&fetchEngine.mutex);
+    fetchEngine.maxPerHost = maxPerHost > 0 ? maxPerHost : 1;
+    //Hosts that were at the old limit may have room now
+    for (size_t i = 0; i < FE_HOST_BUCKETS; i++)
+    {
+        for (struct fetchHost *host = fetchEngine.hosts[i]; host != nullptr; host = host->nextInTable)
+        {
+            fe_make_ready(host);
+        }
+    }
+    mtx_unlock(&fetchEngine.mutex);
+    fe_wake();
+}
+
+resizableBuffer fe_fetch_sync(const char *host, const char *selector, int port)
+{
+    return fe_fetch_sync_ex(host, selector, port, nullptr);
+}
+
+resizableBuffer fe_fetch_sync_ex(const char *host, const char *selector, int port, const fetchOptions *options)
+{
+    return fe_fetch_sync_timed(host, selector, port, options).data;
+}
+
+fetchResult fe_fetch_sync_timed(const char *host, const char *selector, int port, const fetchOptions *options)
+{
+    fetchRequest *request = fe_submit_ex(host, selector, port, options, nullptr, nullptr);
+    fe_wait(request);
+    fetchResult output = { .data = fe_take_result(request), .status = fe_status(request), .timing = fe_timing(request) };
+    fe_release(request);
+    return output;
+}
+
+/*
+ Everything below this point runs exclusively on the engine's I/O thread.
+ */
+
+//Whatever ran the process out of descriptors may have passed, so the full budget is available again
+static void fe_socket_closed()
+{
+    fetchEngine.numSockets--;
+    fetchEngine.maxSockets = fetchEngine.socketBudget;
+}
+
+static void fe_close_attempt(fetchRequest *request, struct connectAttempt *attempt)
+{
+    if (attempt->sock == -1) return;
+    epoll_ctl(fetchEngine.epollFd, EPOLL_CTL_DEL, attempt->sock, nullptr);
+    close(attempt->sock);
+    fe_socket_closed();
+    attempt->sock = -1;
+    if (attempt != request->connection) request->numAttempts--;
+}
+
+static void fe_close_warm_socket(struct warmSocket *warm)
+{
+    epoll_ctl(fetchEngine.epollFd, EPOLL_CTL_DEL, warm->attempt.sock, nullptr);
+    close(warm->attempt.sock);
+    fe_socket_closed();
+    warm->attempt.sock = -1;
+    warm->connected = false;
+}
+
+/*
+ Closes any pre-connected sockets that have expired or belong to a host that is no longer kept warm,
+ and opens new ones until the pool is back to the size it was asked for.
+ Lowers nextDeadline to when the pool expires, if that's sooner.
+ */
+static void fe_fill_warm_pool(uint64_t now, uint64_t *nextDeadline)
+{
+    mtx_lock(&fetchEngine.mutex);
+    bool live = fetchEngine.warmTarget.host != HOST_ID_NONE && now < fetchEngine.warmTarget.deadline;
+    bool resolved = fetchEngine.warmTarget.resolved;
+    size_t count = fetchEngine.warmTarget.count;
+    uint64_t generation = fetchEngine.warmTarget.generation;
+    uint64_t deadline = fetchEngine.warmTarget.deadline;
+    resolvedAddr addr = fetchEngine.warmTarget.addrs.addrs[0];
+    mtx_unlock(&fetchEngine.mutex);
+
+    size_t numOpen = 0;
+    for (size_t i = 0; i < FE_WARM_POOL_MAX; i++)
+    {
+        struct warmSocket *warm = &fetchEngine.warmSockets[i];
+        if (warm->attempt.sock == -1) continue;
+        if (!live || warm->generation != generation) fe_close_warm_socket(warm);
+        else numOpen++;
+    }
+    if (!live) return;
+    if (deadline < *nextDeadline) *nextDeadline = deadline;
+    if (!resolved) return;
+    //Queued transactions come first when descriptors are short
+    for (size_t i = 0; i < FE_WARM_POOL_MAX && numOpen < count && fetchEngine.numSockets < fetchEngine.maxSockets; i++)
+    {
+        struct warmSocket *warm = &fetchEngine.warmSockets[i];
+        if (warm->attempt.sock != -1) continue;
+        int sock = socket(addr.addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (sock == -1) return;
+        uint64_t connectStart = ft_now();
+        if (connect(sock, (struct sockaddr *) &addr.addr, addr.addrLen) != 0 && errno != EINPROGRESS)
+        {
+            close(sock);
+            return;
+        }
+        *warm = (struct warmSocket) { .attempt = { .request = nullptr, .sock = sock }, .generation = generation,
+                                      .connectStart = connectStart };
+        fetchEngine.numSockets++;
+        struct epoll_event event = { .events = EPOLLOUT, .data.ptr = &warm->attempt };
+        epoll_ctl(fetchEngine.epollFd, EPOLL_CTL_ADD, sock, &event);
+        numOpen++;
+    }
+}
+
+static void fe_handle_warm_event(struct warmSocket *warm)
+{
+    if (warm->connected)
+    {
+        //An idle connection only hears from the server when it gives up on us
+        fe_close_warm_socket(warm);
+        return;
+    }
+    int error = 0;
+    socklen_t errorLen = sizeof(error);
+    getsockopt(warm->attempt.sock, SOL_SOCKET, SO_ERROR, &error, &errorLen);
+    if (error != 0)
+    {
+        fe_close_warm_socket(warm);
+        //Don't keep hammering a host that won't have us; the next fe_warm_host call tries again
+        mtx_lock(&fetchEngine.mutex);
+        if (fetchEngine.warmTarget.generation == warm->generation) fetchEngine.warmTarget.count = 0;
+        mtx_unlock(&fetchEngine.mutex);
+        return;
+    }
+    warm->connected = true;
+    warm->connectEnd = ft_now();
+    struct epoll_event event = { .events = EPOLLRDHUP, .data.ptr = &warm->attempt };
+    epoll_ctl(fetchEngine.epollFd, EPOLL_CTL_MOD, warm->attempt.sock, &event);
+}
+
+static void fe_handle_send(fetchRequest *request);
+
+/*
+ Hands the request an idle pre-connected socket to its host, if the pool has one.
+ Returns false if it has to connect for itself.
+ */
+static bool fe_take_warm_socket(fetchRequest *request)
+{
+    mtx_lock(&fetchEngine.mutex);
+    bool matches = fetchEngine.warmTarget.host != HOST_ID_NONE && fetchEngine.warmTarget.host == request->host
+            && fetchEngine.warmTarget.port == request->port;
+    uint64_t generation = fetchEngine.warmTarget.generation;
+    mtx_unlock(&fetchEngine.mutex);
+    if (!matches) return false;
+    for (size_t i = 0; i < FE_WARM_POOL_MAX; i++)
+    {
+        struct warmSocket *warm = &fetchEngine.warmSockets[i];
+        if (warm->attempt.sock == -1 || !warm->connected || warm->generation != generation) continue;
+        //The server may have hung up since we last heard from it
+        char byte;
+        ssize_t peeked = recv(warm->attempt.sock, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+        if (peeked != -1 || (errno != EAGAIN && errno != EWOULDBLOCK))
+        {
+            fe_close_warm_socket(warm);
+            continue;
+        }
+        struct connectAttempt *attempt = &request->attempts[0];
+        attempt->request = request;
+        attempt->sock = warm->attempt.sock;
+        warm->attempt.sock = -1;
+        warm->connected = false;
+        request->connection = attempt;
+        request->sock = attempt->sock;
+        request->timing.connectEnd = ft_now();
+        request->timing.connectSaved = warm->connectEnd - warm->connectStart;
+        struct epoll_event event = { .events = EPOLLOUT, .data.ptr = attempt };
+        epoll_ctl(fetchEngine.epollFd, EPOLL_CTL_MOD, request->sock, &event);
+        request->state = FETCH_STATE_SENDING;
+        fe_handle_send(request);
+        return true;
+    }
+    return false;
+}
+
+static void fe_complete(fetchRequest *request, fetchStatus status)
+{
+    for (size_t i = 0; i < request->addrs.count; i++)
+    {
+        fe_close_attempt(request, &request->attempts[i]);
+    }
+    request->sock = -1;
+    request->nextAttemptAt = 0;
+    if (request->active)
+    {
+        request->active = false;
+        mtx_lock(&fetchEngine.mutex);
+        fetchEngine.numActive--;
+        struct fetchHost *host = request->scheduledHost;
+        host->numActive--;
+        request->scheduledHost = nullptr;
+        fe_make_ready(host);
+        fe_put_host(host);
+        mtx_unlock(&fetchEngine.mutex);
+    }
+    //Keep a terminator just past the data so text responses can be parsed in place
+    if (status == FETCH_OK && !bp_reserve(&request->response, 1)) status = FETCH_ERROR_NO_MEMORY;
+    if (status == FETCH_OK)
+    {
+        ((char *)request->response.contents)[request->response.count] = '\0';
+        request->result = srb_new(request->response);
+        request->response = RB_EMPTY;
+    }
+    bp_return(&request->response);
+
+    mtx_lock(&fetchEngine.mutex);
+    fe_mark_finishing(request);
+    request->status = status;
+    request->timing.end = ft_now();
+    //Nothing can join once the request is finishing, so the list of followers is final
+    fetchRequest *followers = request->followers;
+    request->followers = nullptr;
+    for (fetchRequest *follower = followers; follower != nullptr; follower = follower->nextFollower)
+    {
+        follower->status = status;
+        follower->leader = nullptr;
+        follower->timing = request->timing;
+        follower->result = srb_ref(request->result);
+    }
+    mtx_unlock(&fetchEngine.mutex);
+    ft_record(&request->timing);
+
+    request->nextFollower = followers;
+    for (fetchRequest *current = request; current != nullptr; current = current->nextFollower)
+    {
+        //Waiters are only woken after the callback has run, so they always see its effects
+        if (current->onComplete != nullptr) current->onComplete(current, current->userData);
+
+        mtx_lock(&fetchEngine.mutex);
+        current->state = FETCH_STATE_DONE;
+        cnd_broadcast(&fetchEngine.completed);
+        mtx_unlock(&fetchEngine.mutex);
+
+        //epoll may already have handed us more events for this request's sockets in the current batch,
+        //so the engine's reference is only dropped once the batch has been processed
+        current->nextRelease = fetchEngine.releaseList;
+        fetchEngine.releaseList = current;
+    }
+}
+
+/*
+ Starts a non-blocking connection attempt to the next address on the request's list.
+ Returns false if there were no addresses left to try.
+ */
+static bool fe_start_next_attempt(fetchRequest *request)
+{
+    //Racing another address is optional, so it waits when we're short of descriptors
+    if (request->numAttempts > 0 && fetchEngine.numSockets >= fetchEngine.maxSockets)
+    {
+        request->nextAttemptAt = ft_now() + FE_CONNECTION_ATTEMPT_DELAY_MS * NS_PER_MS;
+        return true;
+    }
+    while (request->nextAddr < request->addrs.count)
+    {
+        size_t index = request->nextAddr++;
+        resolvedAddr *addr = &request->addrs.addrs[index];
+        struct connectAttempt *attempt = &request->attempts[index];
+        attempt->request = request;
+        attempt->sock = socket(addr->addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (attempt->sock == -1)
+        {
+            request->lastConnectError = errno;
+            fprintf(stderr, "Could not create socket for %s: %s\n", hi_str(request->host), strerror(errno));
+            if (errno == EMFILE || errno == ENFILE)
+            {
+                //Somebody else is using more descriptors than we planned for. That's usually a passing burst,
+                //so hold off on opening more until one of ours closes, and try this address again after the attempt delay
+                //instead of skipping it. The connect deadline still applies if descriptors never come back.
+                if (fetchEngine.numSockets > 0) fetchEngine.maxSockets = fetchEngine.numSockets;
+                request->nextAddr--;
+                request->nextAttemptAt = ft_now() + FE_CONNECTION_ATTEMPT_DELAY_MS * NS_PER_MS;
+                return true;
+            }
+            continue;
+        }
+        fetchEngine.numSockets++;
+        int error = connect(attempt->sock, (struct sockaddr *) &addr->addr, addr->addrLen);
+        if (error != 0 && errno != EINPROGRESS)
+        {
+            request->lastConnectError = errno;
+            close(attempt->sock);
+            fe_socket_closed();
+            attempt->sock = -1;
+            continue;
+        }
+        //Whether or not the connection completed immediately, writability tells us when it's ready
+        struct epoll_event event = { .events = EPOLLOUT, .data.ptr = attempt };
+        epoll_ctl(fetchEngine.epollFd, EPOLL_CTL_ADD, attempt->sock, &event);
+        request->numAttempts++;
+        request->nextAttemptAt = request->nextAddr < request->addrs.count
+                ? ft_now() + FE_CONNECTION_ATTEMPT_DELAY_MS * NS_PER_MS : 0;
+        return true;
+    }
+    request->nextAttemptAt = 0;
+    return false;
+}
+
+static void fe_connect_failed(fetchRequest *request)
+{
+    if (request->numAttempts > 0 || fe_start_next_attempt(request)) return;
+    fprintf(stderr, "Could not establish connection to %s port %d: %s\n", hi_str(request->host), request->port,
+            strerror(request->lastConnectError != 0 ? request->lastConnectError : errno));
+    fe_complete(request, FETCH_ERROR_CONNECT);
+}
+
+static void fe_start(fetchRequest *request)
+{
+    if (request->status != FETCH_PENDING)
+    {
+        fe_complete(request, request->status);
+        return;
+    }
+    request->phaseDeadline = fe_deadline_after(request->options.connectTimeoutMs);
+    request->timing.connectStart = ft_now();
+    request->response = bp_take(DEFAULT_BUFFER_SIZE);
+    request->state = FETCH_STATE_CONNECTING;
+    if (fe_take_warm_socket(request)) return;
+    fe_connect_failed(request); //With nothing in progress yet, this starts the first attempt
+}
+
+/*
+ Starts queued requests for as long as there is room, highest priority first. Within a priority, it takes one at a time
+ from each host that has any waiting, so a host with a long queue only gets its turn with everybody else.
+ */
+static void fe_start_queued()
+{
+    while (true)
+    {
+        mtx_lock(&fetchEngine.mutex);
+        fetchPriority priority = 0;
+        while (priority < FETCH_PRIORITY_COUNT && fetchEngine.readyHead[priority] == nullptr) priority++;
+        if (priority == FETCH_PRIORITY_COUNT || fetchEngine.numActive >= fetchEngine.maxActive
+            || fetchEngine.numSockets >= fetchEngine.maxSockets)
+        {
+            mtx_unlock(&fetchEngine.mutex);
+            return;
+        }
+        struct fetchHost *host = fetchEngine.readyHead[priority];
+        fetchEngine.readyHead[priority] = host->nextReady[priority];
+        if (fetchEngine.readyHead[priority] == nullptr) fetchEngine.readyTail[priority] = nullptr;
+        host->ready[priority] = false;
+        fetchRequest *request = host->queueHead[priority];
+        if (request == nullptr || host->numActive >= fetchEngine.maxPerHost)
+        {
+            //Its queue was emptied by a change of priority, or it filled up at another priority since it was listed.
+            //It's put back once it has something to start and room to start it.
+            fe_make_ready(host);
+            fe_put_host(host);
+            mtx_unlock(&fetchEngine.mutex);
+            continue;
+        }
+        host->queueHead[priority] = request->next;
+        if (host->queueHead[priority] == nullptr) host->queueTail[priority] = nullptr;
+        request->next = nullptr;
+        bool finishing = request->finishing;
+        if (finishing) request->scheduledHost = nullptr;
+        else
+        {
+            request->active = true;
+            fetchEngine.numActive++;
+            host->numActive++;
+        }
+        fe_make_ready(host); //Back of the line, if it still has anything waiting
+        fe_put_host(host);
+        mtx_unlock(&fetchEngine.mutex);
+        if (!finishing) fe_start(request);
+        fe_release(request); //The queue's reference
+    }
+}
+
+static void fe_handle_send(fetchRequest *request)
+{
+    size_t messageLength = sb_len(request->message);
+    while (request->bytesSent < messageLength)
+    {
+        ssize_t len = send(request->sock, request->message.contents + request->bytesSent,
+                           messageLength - request->bytesSent, MSG_NOSIGNAL);
+        if (len == -1)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+            fprintf(stderr, "Could not send selector to %s: %s\n", hi_str(request->host), strerror(errno));
+            fe_complete(request, FETCH_ERROR_IO);
+            return;
+        }
+        request->bytesSent += len;
+    }
+    request->state = FETCH_STATE_RECEIVING;
+    request->timing.requestSent = ft_now();
+    request->phaseDeadline = fe_deadline_after(request->options.firstByteTimeoutMs);
+    struct epoll_event event = { .events = EPOLLIN, .data.ptr = request->connection };
+    epoll_ctl(fetchEngine.epollFd, EPOLL_CTL_MOD, request->sock, &event);
+}
+
+static void fe_handle_connect(struct connectAttempt *attempt)
+{
+    fetchRequest *request = attempt->request;
+    int error = 0;
+    socklen_t errorLen = sizeof(error);
+    getsockopt(attempt->sock, SOL_SOCKET, SO_ERROR, &error, &errorLen);
+    if (error != 0)
+    {
+        request->lastConnectError = error;
+        fe_close_attempt(request, attempt);
+        //No point waiting out the attempt delay when we already know this address is no good
+        fe_connect_failed(request);
+        return;
+    }
+
+    //First one through wins; everything else still trying is abandoned
+    request->connection = attempt;
+    request->numAttempts--;
+    for (size_t i = 0; i < request->addrs.count; i++)
+    {
+        if (&request->attempts[i] != attempt) fe_close_attempt(request, &request->attempts[i]);
+    }
+    request->nextAttemptAt = 0;
+    request->sock = attempt->sock;
+    request->timing.connectEnd = ft_now();
+    resolvedAddr *addr = &request->addrs.addrs[attempt - request->attempts];
+    addr_cache_set_preferred_family(request->host, addr->addr.ss_family);
+
+    request->state = FETCH_STATE_SENDING;
+    fe_handle_send(request);
+}
+
+static void fe_handle_recv(fetchRequest *request)
+{
+    while (true)
+    {
+        //Receive straight into the response's spare capacity rather than bouncing through the stack
+        if (!bp_reserve(&request->response, DEFAULT_BUFFER_SIZE))
+        {
+            fprintf(stderr, "Could not grow the response buffer past %zu bytes\n", request->response.count);
+            fe_complete(request, FETCH_ERROR_NO_MEMORY);
+            return;
+        }
+        char *chunk = rb_tail(&request->response);
+        ssize_t len = recv(request->sock, chunk, rb_spare_capacity(request->response), 0);
+        request->timing.recvCalls++;
+        if (len == 0)
+        {
+            fe_complete(request, FETCH_OK);
+            return;
+        }
+        if (len == -1)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+            fprintf(stderr, "Could not receive data: %s\n", strerror(errno));
+            fe_complete(request, FETCH_ERROR_IO);
+            return;
+        }
+        rb_commit(&request->response, len);
+        request->timing.bytesReceived += len;
+        if (request->options.onChunk != nullptr) request->options.onChunk(chunk, len, request->options.chunkUserData);
+        if (request->timing.firstByte == 0)
+        {
+            request->timing.firstByte = ft_now();
+            request->phaseDeadline = 0; //Past the first byte, only the total deadline applies
+        }
+    }
+}
+
+static void fe_handle_event(struct connectAttempt *attempt, uint32_t events)
+{
+    //Stale event for a socket that was closed earlier in the same batch
+    if (attempt->sock == -1) return;
+    if (attempt->request == nullptr)
+    {
+        fe_handle_warm_event((struct warmSocket *)attempt);
+        return;
+    }
+    fetchRequest *request = attempt->request;
+    switch (request->state)
+    {
+        case FETCH_STATE_CONNECTING:
+            fe_handle_connect(attempt);
+            break;
+        case FETCH_STATE_SENDING:
+            fe_handle_send(request);
+            break;
+        case FETCH_STATE_RECEIVING:
+            //A hangup still needs to be read through to pick up the final bytes and the EOF
+            if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) fe_handle_recv(request);
+            break;
+        default:
+            break;
+    }
+}
+
+static bool fe_expired(fetchRequest *request, uint64_t now, fetchStatus *status)
+{
+    if (fe_is_cancelled(request->cancelToken))
+    {
+        *status = FETCH_CANCELLED;
+        return true;
+    }
+    if ((request->totalDeadline != 0 && now >= request->totalDeadline)
+        || (request->phaseDeadline != 0 && now >= request->phaseDeadline))
+    {
+        *status = FETCH_ERROR_TIMEOUT;
+        return true;
+    }
+    return false;
+}
+
+/*
+ Finishes every request that has been cancelled or run past one of its deadlines, starts any connection attempts
+ that are due, tops up the warm pool, and returns how long epoll_wait may sleep before the next timer comes up(-1 for indefinitely).
+ */
+static int fe_run_timers()
+{
+    uint64_t now = ft_now();
+    uint64_t nextDeadline = UINT64_MAX;
+    fetchRequest *expired = nullptr;
+    fetchRequest *attemptsDue = nullptr;
+
+    mtx_lock(&fetchEngine.mutex);
+    for (fetchRequest *request = fetchEngine.live, *next; request != nullptr; request = next)
+    {
+        next = request->nextLive;
+        fetchStatus status;
+        if (fe_expired(request, now, &status))
+        {
+            //Claim the request now so a lookup finishing concurrently leaves it alone
+            fe_mark_finishing(request);
+            request->status = status;
+            request->nextDue = expired;
+            expired = request;
+            continue;
+        }
+        if (request->nextAttemptAt != 0)
+        {
+            if (now >= request->nextAttemptAt)
+            {
+                request->nextDue = attemptsDue;
+                attemptsDue = request;
+            }
+            else if (request->nextAttemptAt < nextDeadline) nextDeadline = request->nextAttemptAt;
+        }
+        if (request->totalDeadline != 0 && request->totalDeadline < nextDeadline) nextDeadline = request->totalDeadline;
+        if (request->phaseDeadline != 0 && request->phaseDeadline < nextDeadline) nextDeadline = request->phaseDeadline;
+    }
+    mtx_unlock(&fetchEngine.mutex);
+
+    while (expired != nullptr)
+    {
+        fetchRequest *request = expired;
+        expired = request->nextDue;
+        if (request->status == FETCH_ERROR_TIMEOUT)
+            fprintf(stderr, "Timed out loading %s port %d\n", hi_str(request->host), request->port);
+        fe_complete(request, request->status);
+    }
+    while (attemptsDue != nullptr)
+    {
+        fetchRequest *request = attemptsDue;
+        attemptsDue = request->nextDue;
+        //Nothing has connected within the attempt delay, so race the next address against the ones in progress.
+        //A request that was waiting on descriptors may have nothing in progress, and fails if there's nothing left to try.
+        if (!fe_start_next_attempt(request)) fe_connect_failed(request);
+        if (request->nextAttemptAt != 0 && request->nextAttemptAt < nextDeadline) nextDeadline = request->nextAttemptAt;
+    }
+    fe_fill_warm_pool(now, &nextDeadline);
+
+    if (nextDeadline == UINT64_MAX) return -1;
+    now = ft_now();
+    return nextDeadline <= now ? 0 : (int)((nextDeadline - now + NS_PER_MS - 1) / NS_PER_MS);
+}
+
+static void fe_release_completed()
+{
+    while (fetchEngine.releaseList != nullptr)
+    {
+        fetchRequest *request = fetchEngine.releaseList;
+        fetchEngine.releaseList = request->nextRelease;
+        fe_release(request);
+    }
+}
+
+static int fe_thread_main([[maybe_unused]] void *arg)
+{
+    struct epoll_event events[FE_MAX_EVENTS];
+    while (true)
+    {
+        fe_start_queued();
+        int timeout = fe_run_timers();
+        fe_release_completed();
+        int numEvents = epoll_wait(fetchEngine.epollFd, events, FE_MAX_EVENTS, timeout);
+        if (numEvents == -1)
+        {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "Fetch engine failed: %s\n", strerror(errno));
+            return 1;
+        }
+        for (int i = 0; i < numEvents; i++)
+        {
+            if (events[i].data.ptr == nullptr)
+            {
+                uint64_t count;
+                read(fetchEngine.wakeFd, &count, sizeof(count));
+                continue;
+            }
+            fe_handle_event(events[i].data.ptr, events[i].events);
+        }
+        fe_release_completed();
+    }
+}
+
+#endif
\ No newline at end of file
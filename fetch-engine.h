@@ -0,0 +1,242 @@
+/*
+*  This Source Code Form is subject to the terms of the Mozilla Public
+*  License, v. 2.0. If a copy of the MPL was not distributed with this
+*  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#ifndef GOPHERBROWSER_FETCH_ENGINE_H
+#define GOPHERBROWSER_FETCH_ENGINE_H
+
+#include <stdbool.h>
+#include "buffer-utils.h"
+#include "fetch-timing.h"
+
+//Maximum number of transactions that may have an open socket at once.
+//Anything submitted beyond this waits in the engine's queue until a slot frees up.
+#define FE_DEFAULT_MAX_ACTIVE 256
+
+//Maximum number of transactions that may be connected to a single host at once.
+//Hosts with requests waiting take turns, so one busy host can't hold up the rest.
+#define FE_DEFAULT_MAX_PER_HOST 6
+
+//Number of file descriptors the engine leaves for the rest of the program when sizing itself to RLIMIT_NOFILE
+#define FE_RESERVED_FDS 64
+
+//Default time limits, in milliseconds. The connect limit runs from when the connection attempt starts,
+//the first byte limit from when the selector has been sent, and the total limit from submission.
+#define FE_DEFAULT_CONNECT_TIMEOUT_MS 10000
+#define FE_DEFAULT_FIRST_BYTE_TIMEOUT_MS 30000
+#define FE_DEFAULT_TOTAL_TIMEOUT_MS 120000
+
+//When a host has several addresses, how long to wait on one connection attempt before racing the next address
+//against it(RFC 8305 recommends 250ms)
+#define FE_CONNECTION_ATTEMPT_DELAY_MS 250
+
+//How many idle pre-connected sockets fe_warm_host may keep open at most, and how many it's usually asked for
+#define FE_WARM_POOL_MAX 4
+#define FE_DEFAULT_WARM_SOCKETS 2
+
+//How long pre-connected sockets are kept around after fe_warm_host, in milliseconds.
+//Gopher servers don't expect to wait long for a selector, so this is kept short.
+#define FE_WARM_IDLE_TIMEOUT_MS 5000
+
+/*
+ Result of a fetch transaction.
+ */
+typedef enum fetchStatus
+{
+    FETCH_PENDING = 0,
+    FETCH_OK,
+    FETCH_ERROR_RESOLVE,
+    FETCH_ERROR_CONNECT,
+    FETCH_ERROR_IO,
+    FETCH_ERROR_TIMEOUT,
+    FETCH_ERROR_NO_MEMORY, //The response couldn't be stored
+    FETCH_CANCELLED
+} fetchStatus;
+
+/*
+ How urgently a transaction is needed. Queued transactions are always started in priority order,
+ so anything the user is waiting on overtakes speculative work that hasn't connected yet.
+ */
+typedef enum fetchPriority
+{
+    FETCH_PRIORITY_FOREGROUND = 0, //The page the user asked for
+    FETCH_PRIORITY_VISIBLE, //Things on screen, e.g. images in the visible part of a menu
+    FETCH_PRIORITY_SPECULATIVE, //Things the user may or may not get to
+    FETCH_PRIORITY_COUNT
+} fetchPriority;
+
+/*
+ Shared flag used to abandon a group of transactions at once, e.g. everything belonging to a page load.
+ Should be created with fe_cancel_token_new and released with fe_cancel_token_release.
+ */
+typedef struct fetchCancelToken fetchCancelToken;
+
+/*
+ Called on the engine's I/O thread with each piece of a response as it arrives, in order.
+ data is only valid for the duration of the call.
+ */
+typedef void (*fetchChunkCallback)(const char *data, size_t length, void *userData);
+
+/*
+ Per-transaction settings. Timeouts of 0 mean no limit.
+ */
+typedef struct fetchOptions
+{
+    unsigned int connectTimeoutMs;
+    unsigned int firstByteTimeoutMs;
+    unsigned int totalTimeoutMs;
+    fetchCancelToken *cancelToken; //May be nullptr. The transaction keeps its own reference.
+    fetchPriority priority;
+    fetchChunkCallback onChunk; //May be nullptr. Transactions with one never share a transfer with duplicates.
+    void *chunkUserData;
+} fetchOptions;
+
+#define FETCH_OPTIONS_DEFAULT ((fetchOptions) { .connectTimeoutMs = FE_DEFAULT_CONNECT_TIMEOUT_MS, \
+                                                .firstByteTimeoutMs = FE_DEFAULT_FIRST_BYTE_TIMEOUT_MS, \
+                                                .totalTimeoutMs = FE_DEFAULT_TOTAL_TIMEOUT_MS, \
+                                                .cancelToken = nullptr, \
+                                                .priority = FETCH_PRIORITY_FOREGROUND, \
+                                                .onChunk = nullptr, \
+                                                .chunkUserData = nullptr })
+
+/*
+ Everything known about a finished transaction.
+ */
+typedef struct fetchResult
+{
+    resizableBuffer data; //Empty unless status is FETCH_OK
+    fetchStatus status;
+    fetchTiming timing;
+} fetchResult;
+
+/*
+ Handle to a single Gopher transaction driven by the fetch engine.
+ Should be created with fe_submit and released with fe_release.
+ */
+typedef struct fetchRequest fetchRequest;
+
+/*
+ Called on the engine's I/O thread once a transaction has finished, successfully or not.
+ The request is guaranteed to be valid for the duration of the call.
+ */
+typedef void (*fetchCallback)(fetchRequest *request, void *userData);
+
+/*
+ Queues a Gopher transaction for host:port with the given selector and returns immediately.
+ onComplete may be nullptr if the caller intends to use fe_wait instead.
+ If an identical transaction(same host, port, selector and cancellation token) is already running,
+ the new one joins it and shares its response instead of fetching it again.
+
+ NOTE: the returned handle must be released with fe_release when no longer needed.
+ */
+fetchRequest *fe_submit(const char *host, const char *selector, int port, fetchCallback onComplete, void *userData);
+
+/*
+ Same as fe_submit, but with the specified options instead of FETCH_OPTIONS_DEFAULT.
+ options may be nullptr, and is not referenced after the call returns.
+ */
+fetchRequest *fe_submit_ex(const char *host, const char *selector, int port, const fetchOptions *options,
+                           fetchCallback onComplete, void *userData);
+
+/*
+ Blocks the calling thread until the specified transaction has finished.
+ */
+void fe_wait(fetchRequest *request);
+
+/*
+ Gets the status of the specified transaction. Returns FETCH_PENDING if it has not finished yet.
+ */
+fetchStatus fe_status(fetchRequest *request);
+
+/*
+ Transfers ownership of the received data to the caller.
+ If the data is shared with a duplicate transaction, the caller gets its own copy.
+ Subsequent calls return an empty buffer.
+ */
+resizableBuffer fe_take_result(fetchRequest *request);
+
+/*
+ Gets a new reference to the received data, which may be shared with duplicate transactions, without copying it.
+ Returns nullptr if the transaction did not succeed. Should be released with srb_release.
+ */
+sharedBuffer *fe_share_result(fetchRequest *request);
+
+/*
+ Releases the caller's reference to the transaction.
+ The transaction itself keeps running until it completes.
+ */
+void fe_release(fetchRequest *request);
+
+/*
+ Gets the timing information recorded for the transaction. Should only be called once it has finished.
+ */
+fetchTiming fe_timing(fetchRequest *request);
+
+/*
+ Sets the maximum number of transactions that may be connected at once.
+ */
+void fe_set_max_active(size_t maxActive);
+
+/*
+ Changes the priority of a transaction. Only has an effect while it is still waiting to connect.
+ */
+void fe_set_priority(fetchRequest *request, fetchPriority priority);
+
+/*
+ Sets the maximum number of transactions that may be connected to a single host at once.
+ */
+void fe_set_max_per_host(size_t maxPerHost);
+
+/*
+ Keeps count idle sockets connected to the specified host and port for the next FE_WARM_IDLE_TIMEOUT_MS milliseconds,
+ so a transaction to it can skip straight to sending its selector. Sockets that get used are replaced until then.
+ Only one host is kept warm at a time; calling this again with another host closes the previous one's sockets,
+ and a nullptr host or a count of 0 closes them all.
+ */
+void fe_warm_host(const char *host, int port, size_t count);
+
+/*
+ Submits a transaction and waits for it to complete, returning the received data.
+ Returns an empty buffer on failure.
+ */
+resizableBuffer fe_fetch_sync(const char *host, const char *selector, int port);
+
+/*
+ Same as fe_fetch_sync, but with the specified options. Returns an empty buffer on failure, timeout or cancellation.
+ */
+resizableBuffer fe_fetch_sync_ex(const char *host, const char *selector, int port, const fetchOptions *options);
+
+/*
+ Same as fe_fetch_sync_ex, but also returns the status and a breakdown of where the time went.
+ */
+fetchResult fe_fetch_sync_timed(const char *host, const char *selector, int port, const fetchOptions *options);
+
+/*
+ Creates a new cancellation token.
+ */
+fetchCancelToken *fe_cancel_token_new();
+
+/*
+ Adds a reference to the token and returns it.
+ */
+fetchCancelToken *fe_cancel_token_ref(fetchCancelToken *token);
+
+/*
+ Cancels every transaction using the token. Transactions that have not finished yet complete with FETCH_CANCELLED
+ and release their sockets and buffers straight away. Transactions submitted with the token later are cancelled immediately.
+ */
+void fe_cancel(fetchCancelToken *token);
+
+/*
+ Determines whether the token has been cancelled.
+ */
+bool fe_is_cancelled(fetchCancelToken *token);
+
+/*
+ Releases the caller's reference to the token.
+ */
+void fe_cancel_token_release(fetchCancelToken *token);
+
+#endif //GOPHERBROWSER_FETCH_ENGINE_H
\ No newline at end of file
@@ -0,0 +1,157 @@
+/*
+*  This Source Code Form is subject to the terms of the Mozilla Public
+*  License, v. 2.0. If a copy of the MPL was not distributed with this
+*  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#include "fetch-timing.h"
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#define NS_PER_US 1000ULL
+
+//Bucket i counts durations in [2^(i-1), 2^i) microseconds, with bucket 0 holding anything under a microsecond
+static struct
+{
+    atomic_size_t buckets[FETCH_PHASE_COUNT][FT_HISTOGRAM_BUCKETS];
+    atomic_uint_least64_t totalNs[FETCH_PHASE_COUNT];
+    atomic_size_t samples[FETCH_PHASE_COUNT];
+    atomic_size_t transactions;
+    atomic_size_t bytesReceived;
+    atomic_size_t recvCalls;
+    atomic_size_t warmConnections;
+    atomic_uint_least64_t connectSavedNs;
+} fetchStats;
+
+static const char *const phaseNames[FETCH_PHASE_COUNT] = { "DNS", "Connect", "First byte", "Transfer", "Total" };
+
+uint64_t ft_now()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+static uint64_t interval(uint64_t from, uint64_t to)
+{
+    return from == 0 || to < from ? 0 : to - from;
+}
+
+uint64_t ft_phase_ns(const fetchTiming *timing, fetchPhase phase)
+{
+    switch (phase)
+    {
+        case FETCH_PHASE_DNS:
+            return interval(timing->start, timing->dnsEnd);
+        case FETCH_PHASE_CONNECT:
+            return interval(timing->connectStart, timing->connectEnd);
+        case FETCH_PHASE_FIRST_BYTE:
+            return interval(timing->requestSent, timing->firstByte);
+        case FETCH_PHASE_TRANSFER:
+            return interval(timing->firstByte, timing->end);
+        case FETCH_PHASE_TOTAL:
+            return interval(timing->start, timing->end);
+        default:
+            return 0;
+    }
+}
+
+static bool phase_reached(const fetchTiming *timing, fetchPhase phase)
+{
+    switch (phase)
+    {
+        case FETCH_PHASE_DNS:
+            return timing->dnsEnd != 0;
+        case FETCH_PHASE_CONNECT:
+            return timing->connectEnd != 0;
+        case FETCH_PHASE_FIRST_BYTE:
+            return timing->firstByte != 0;
+        case FETCH_PHASE_TRANSFER:
+            return timing->end != 0 && timing->firstByte != 0;
+        case FETCH_PHASE_TOTAL:
+            return timing->end != 0;
+        default:
+            return false;
+    }
+}
+
+static size_t bucket_index(uint64_t ns)
+{
+    uint64_t us = ns / NS_PER_US;
+    size_t index = 0;
+    while (us != 0 && index < FT_HISTOGRAM_BUCKETS - 1)
+    {
+        us >>= 1;
+        index++;
+    }
+    return index;
+}
+
+void ft_record(const fetchTiming *timing)
+{
+    for (fetchPhase phase = 0; phase < FETCH_PHASE_COUNT; phase++)
+    {
+        if (!phase_reached(timing, phase)) continue;
+        uint64_t ns = ft_phase_ns(timing, phase);
+        atomic_fetch_add_explicit(&fetchStats.buckets[phase][bucket_index(ns)], 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&fetchStats.totalNs[phase], ns, memory_order_relaxed);
+        atomic_fetch_add_explicit(&fetchStats.samples[phase], 1, memory_order_relaxed);
+    }
+    atomic_fetch_add_explicit(&fetchStats.transactions, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&fetchStats.bytesReceived, timing->bytesReceived, memory_order_relaxed);
+    atomic_fetch_add_explicit(&fetchStats.recvCalls, timing->recvCalls, memory_order_relaxed);
+    if (timing->connectSaved != 0)
+    {
+        atomic_fetch_add_explicit(&fetchStats.warmConnections, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&fetchStats.connectSavedNs, timing->connectSaved, memory_order_relaxed);
+    }
+}
+
+void ft_dump_histograms(FILE *stream)
+{
+    size_t transactions = atomic_load(&fetchStats.transactions);
+    fprintf(stream, "Fetch timing: %zu transactions, %zu bytes in %zu recv calls\n", transactions,
+            atomic_load(&fetchStats.bytesReceived), atomic_load(&fetchStats.recvCalls));
+    size_t warmConnections = atomic_load(&fetchStats.warmConnections);
+    if (warmConnections != 0)
+    {
+        double savedMs = (double)atomic_load(&fetchStats.connectSavedNs) / 1e6;
+        fprintf(stream, "Pre-connected sockets: %zu used, saving %.3fms in total, %.3fms each\n", warmConnections, savedMs,
+                savedMs / (double)warmConnections);
+    }
+    for (fetchPhase phase = 0; phase < FETCH_PHASE_COUNT; phase++)
+    {
+        size_t samples = atomic_load(&fetchStats.samples[phase]);
+        if (samples == 0) continue;
+        double meanMs = (double)atomic_load(&fetchStats.totalNs[phase]) / (double)samples / 1e6;
+        fprintf(stream, "%s: %zu samples, mean %.3fms\n", phaseNames[phase], samples, meanMs);
+        for (size_t i = 0; i < FT_HISTOGRAM_BUCKETS; i++)
+        {
+            size_t count = atomic_load(&fetchStats.buckets[phase][i]);
+            if (count == 0) continue;
+            //Upper bound of the bucket, in microseconds
+            uint64_t limit = 1ULL << i;
+            if (i == FT_HISTOGRAM_BUCKETS - 1) fprintf(stream, "  >= %10lluus: %zu\n", (unsigned long long)(limit >> 1), count);
+            else fprintf(stream, "  <  %10lluus: %zu\n", (unsigned long long)limit, count);
+        }
+    }
+}
+
+void ft_reset_histograms()
+{
+    for (fetchPhase phase = 0; phase < FETCH_PHASE_COUNT; phase++)
+    {
+        for (size_t i = 0; i < FT_HISTOGRAM_BUCKETS; i++)
+        {
+            atomic_store(&fetchStats.buckets[phase][i], 0);
+        }
+        atomic_store(&fetchStats.totalNs[phase], 0);
+        atomic_store(&fetchStats.samples[phase], 0);
+    }
+    atomic_store(&fetchStats.transactions, 0);
+    atomic_store(&fetchStats.bytesReceived, 0);
+    atomic_store(&fetchStats.recvCalls, 0);
+    atomic_store(&fetchStats.warmConnections, 0);
+    atomic_store(&fetchStats.connectSavedNs, 0);
+}
\ No newline at end of file
@@ -0,0 +1,72 @@
+/*
+*  This Source Code Form is subject to the terms of the Mozilla Public
+*  License, v. 2.0. If a copy of the MPL was not distributed with this
+*  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#ifndef GOPHERBROWSER_FETCH_TIMING_H
+#define GOPHERBROWSER_FETCH_TIMING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+//Number of power-of-two buckets in each histogram. The last one also holds everything longer.
+#define FT_HISTOGRAM_BUCKETS 24
+
+/*
+ Where the time went in a single transaction. Timestamps are monotonic, in nanoseconds,
+ and are 0 for phases the transaction never reached.
+ */
+typedef struct fetchTiming
+{
+    uint64_t start; //When the transaction was submitted; also the start of the DNS lookup
+    uint64_t dnsEnd;
+    uint64_t connectStart;
+    uint64_t connectEnd;
+    uint64_t requestSent; //The whole selector has been handed to the kernel
+    uint64_t firstByte;
+    uint64_t end;
+    size_t bytesReceived;
+    size_t recvCalls;
+    uint64_t connectSaved; //How long connecting took for the pre-connected socket the transaction used, or 0
+} fetchTiming;
+
+typedef enum fetchPhase
+{
+    FETCH_PHASE_DNS = 0,
+    FETCH_PHASE_CONNECT,
+    FETCH_PHASE_FIRST_BYTE, //From the selector being sent to the first byte of the response, i.e. server think time
+    FETCH_PHASE_TRANSFER, //From the first byte to the end of the response
+    FETCH_PHASE_TOTAL, //From submission to completion, for every transaction, whether it succeeded or not
+    FETCH_PHASE_COUNT
+} fetchPhase;
+
+/*
+ Gets the current monotonic time in nanoseconds, on the same clock as fetchTiming.
+ */
+uint64_t ft_now();
+
+/*
+ Gets how long the transaction spent in the specified phase, in nanoseconds.
+ Returns 0 if it never got through that phase.
+ */
+uint64_t ft_phase_ns(const fetchTiming *timing, fetchPhase phase);
+
+/*
+ Adds a finished transaction to the process-wide histograms. Safe to call from any thread.
+ */
+void ft_record(const fetchTiming *timing);
+
+/*
+ Writes the process-wide histograms of every phase, along with byte and recv call totals
+ and the time saved by pre-connected sockets, to the specified stream.
+ */
+void ft_dump_histograms(FILE *stream);
+
+/*
+ Clears the process-wide histograms.
+ */
+void ft_reset_histograms();
+
+#endif //GOPHERBROWSER_FETCH_TIMING_H
\ No newline at end of file
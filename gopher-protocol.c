@@ -8,6 +8,18 @@
 #include <assert.h>
 #include "gopher-protocol.h"
 #include "network-interface.h"
+#include "fetch-engine.h"
+#include "resolver.h"
+#include "text-scan.h"
+#include "thread-pool.h"
+#include "buffer-pool.h"
+#include "collections.h"
+
+#if defined(__unix__) || (defined(__APPLE__) && defined(__MACH__))
+#include <unistd.h>
+#endif
+
+CREATE_VECTOR_TYPE(entityVector, ev, gopherEntity)
 
 #define PREV_CHAR_IS(c) (*currentPosition > 0 && source[*currentPosition - 1] == (c))
 
@@ -40,7 +52,7 @@ stringBuilder get_gopher_token(const char *source, size_t *currentPosition)
                 }
                 if (c == '\r' || c == '\n')
                 {
-                    if (sb_len(output) != 0 && !isspace(get_last_char(output.contents)))
+                    if (sb_len(output) != 0 && !isspace(output.contents[sb_len(output) - 1]))
                         return output;
                     else
                     {
@@ -64,36 +76,67 @@ stringBuilder get_gopher_token(const char *source, size_t *currentPosition)
 }
 #undef PREV_CHAR_IS
 
-#define PREV_CHAR_IS(c) (i > 0 && buf[i - 1] == (c))
-#define NEXT_CHAR_IS(c) (i + 1 < bufSize && buf[i + 1] == (c))
-
-stringBuilder parse_gopher_textfile(const char *buf, size_t bufSize)
+/*
+ Removes the extra period from the start of every line that has one, and cuts the text off at the line
+ with nothing but a period on it, moving the rest up to close the gaps. Returns the new length.
+ */
+static size_t gopher_text_unstuff(char *text, size_t length)
 {
-    stringBuilder output = sb_new(bufSize + 1);
-    for (size_t i = 0; i < bufSize; i++)
+    char *end = text + length;
+    char *write = text;
+    for (char *line = text; line < end;)
     {
-        if (!(buf[i] == '.' && PREV_CHAR_IS('\n')))
+        if (*line == '.')
         {
-            output.contents[i] = buf[i]; //This is effectively equivalent to appending the character,
-                                         //but it doesn't require calling the sb_append_char function
-                                         //hundreds or thousands of times.
-                                         //We already allocated as much memory as we're going to use up front.
+            //A period on its own is the end of the text, per RFC 1436
+            if (line + 1 == end || line[1] == '\n' || (line[1] == '\r' && (line + 2 == end || line[2] == '\n'))) break;
+            //Otherwise the server put it there so the line wouldn't be mistaken for the end
+            line++;
         }
-        else if (NEXT_CHAR_IS('\r')) break;
+        //Whole lines are moved at once, and only once something before them has been removed
+        char *lineFeed = memchr(line, '\n', end - line);
+        char *next = lineFeed != nullptr ? lineFeed + 1 : end;
+        if (write != line) memmove(write, line, next - line);
+        write += next - line;
+        line = next;
     }
+    return write - text;
+}
+
+stringBuilder parse_gopher_textfile(const char *buf, size_t bufSize)
+{
+    stringBuilder output = sb_new(bufSize + 1);
+    memcpy(output.contents, buf, bufSize);
+    output.length = gopher_text_unstuff(output.contents, bufSize);
+    output.contents[output.length] = '\0';
     return output;
 }
-#undef NEXT_CHAR_IS
-#undef PREV_CHAR_IS
+
+stringBuilder parse_gopher_textfile_from_buffer(resizableBuffer *source)
+{
+    resizableBuffer text = *source;
+    *source = RB_EMPTY;
+    if (!rb_reserve(&text, 1))
+    {
+        rb_free(&text);
+        return SB_EMPTY;
+    }
+    char *contents = text.contents;
+    size_t length = gopher_text_unstuff(contents, text.count);
+    contents[length] = '\0';
+    return (stringBuilder) { .capacity = text.capacity, .length = length, .contents = contents };
+}
 
 gopherEntity gopher_entity_new(gopherEntityType type, const char *displayName, const char *selector, const char *host, int port)
 {
+    hostId id = hi_intern(host);
     return (gopherEntity)
     {
         .type = type,
         .displayName = sv_new(displayName),
         .selector = sv_new(selector),
-        .host = sv_new(host),
+        .host = hi_name(id),
+        .hostId = id,
         .port = port
     };
 }
@@ -102,8 +145,8 @@ void gopher_entity_free(gopherEntity *entity)
 {
     sv_free(&entity->displayName);
     sv_free(&entity->selector);
-    sv_free(&entity->host);
-    rb_free(&entity->prefetchedData);
+    srb_release(entity->prefetchedData);
+    entity->prefetchedData = nullptr;
 }
 
 #define IS_EMPTY_OR_CRLF(sb) ((sb).capacity == 0 || strcmp((sb).contents, "\r\n") == 0)
@@ -148,24 +191,16 @@ gopherEntity parse_gopher_entity(const char * source, size_t *currentPosition, b
     }
     char type = tokens[0].contents[0];
     int port = (int)strtol(tokens[4].contents, nullptr, 10);
+    hostId host = hi_intern(tokens[3].contents);
     gopherEntity output = {
                 .type = type,
                 .displayName = sv_new_from_sb(tokens[1]),
                 .selector = sv_new_from_sb(tokens[2]),
-                .host = sv_new_from_sb(tokens[3]),
+                .host = hi_name(host),
+                .hostId = host,
                 .port = port
             };
-    switch (output.type)
-    {
-        case GOPHER_ENTITY_IMAGE:
-        case GOPHER_NS_ENTITY_IMAGE:
-        case GOPHER_ENTITY_GIF:
-        case GOPHER_P_ENTITY_BMP:
-            output.prefetchedData = get_gopher_page_ex(output.host.contents, output.selector.contents, output.port);
-            break;
-        default:
-            output.prefetchedData = RB_EMPTY;
-    }
+    output.prefetchedData = nullptr; //Filled in later by gopher_menu_prefetch
     for (i = 0; i < 5; i++)
     {
         sb_free(&tokens[i]);
@@ -175,38 +210,557 @@ gopherEntity parse_gopher_entity(const char * source, size_t *currentPosition, b
 
 gopherMenu parse_gopher_menu(const char *source)
 {
-    size_t entityCount = 0;
-    size_t entityCapacity = 32;
+    return parse_gopher_menu_ex(source, nullptr);
+}
+
+gopherMenu parse_gopher_menu_ex(const char *source, const fetchOptions *prefetchOptions)
+{
+    gopherMenu menu = parse_gopher_menu_without_prefetch(source);
+    gopher_menu_prefetch(&menu, prefetchOptions);
+    return menu;
+}
+
+gopherMenu parse_gopher_menu_without_prefetch(const char *source)
+{
     size_t currentPosition = 0;
     bool reachedEnd = false;
-    gopherEntity *entities = calloc(entityCapacity, sizeof(gopherEntity));
+    entityVector entities = ev_new(32);
     gopherEntity currentEntity = parse_gopher_entity(source, &currentPosition, &reachedEnd);
     do
     {
-        if (entityCount == entityCapacity)
-        {
-            gopherEntity *newBuffer = calloc(entityCapacity += 32, sizeof(gopherEntity));
-            memcpy(newBuffer, entities, entityCount * sizeof(gopherEntity));
-            free(entities);
-            entities = newBuffer;
-        }
-        entities[entityCount] = currentEntity;
-        entityCount++;
+        ev_push(&entities, currentEntity);
         currentEntity = parse_gopher_entity(source, &currentPosition, &reachedEnd);
     } while (!reachedEnd);
 
-    return (gopherMenu) { .entities = entities, .numEntities = entityCount, .freed = false };
+    //The menu takes over the array, and frees it with free
+    gopherMenu menu = { .entities = entities.items, .numEntities = entities.count, .freed = false, .prefetch = nullptr };
+    return menu;
+}
+
+//Type and display name, selector, host and port. Anything after the port, like a Gopher+ marker, is ignored.
+#define MENU_LINE_FIELDS 4
+
+/*
+ Splits the line starting at line into its tab-separated fields, terminating each of them in place,
+ and returns where the next line starts.
+ */
+static char *split_menu_line(char *line, char *end, stringView fields[MENU_LINE_FIELDS], size_t *numFields)
+{
+    char *fieldStart = line, *scan = line;
+    *numFields = 0;
+    while (true)
+    {
+        //Tabs and line breaks are found a whole vector at a time, so the bytes in between are only looked at once
+        char *delimiter = scan + ts_find_delimiter(scan, end - scan);
+        if (delimiter < end && *delimiter == '\t')
+        {
+            if (*numFields < MENU_LINE_FIELDS)
+            {
+                fields[(*numFields)++] = sv_borrow(fieldStart, delimiter - fieldStart);
+                *delimiter = '\0';
+            }
+            fieldStart = scan = delimiter + 1;
+            continue;
+        }
+        //A carriage return is only a line break when it comes right before a line feed or the end of the response
+        if (delimiter < end && *delimiter == '\r' && delimiter + 1 < end && delimiter[1] != '\n')
+        {
+            scan = delimiter + 1;
+            continue;
+        }
+        char *next = delimiter;
+        if (next < end && *next == '\r') next++;
+        if (next < end) next++;
+        if (*numFields < MENU_LINE_FIELDS)
+            fields[(*numFields)++] = sv_borrow(fieldStart, delimiter - fieldStart);
+        *delimiter = '\0';
+        return next;
+    }
+}
+
+enum menuLine
+{
+    MENU_LINE_ENTITY,
+    MENU_LINE_BLANK,
+    MENU_LINE_END
+};
+
+/*
+ Parses the line starting at line into entity, whose strings end up pointing into the line,
+ and sets *next to where the following line starts. entity is only written to for MENU_LINE_ENTITY.
+ */
+static enum menuLine parse_menu_line(char *line, char *end, gopherEntity *entity, char **next)
+{
+    //Same fallbacks as parse_gopher_entity uses for lines that are cut short
+    static const stringView fallbacks[MENU_LINE_FIELDS] = {
+        { .inlined = { .contents = "", .inlineLength = 0 } },
+        { .inlined = { .contents = "/", .inlineLength = 1 } },
+        { .inlined = { .contents = "error.host", .inlineLength = 10 } },
+        { .inlined = { .contents = "70", .inlineLength = 2 } }
+    };
+    stringView fields[MENU_LINE_FIELDS];
+    size_t numFields;
+    *next = split_menu_line(line, end, fields, &numFields);
+    if (sv_len(fields[0]) == 0) return MENU_LINE_BLANK;
+    if (sv_len(fields[0]) == 1 && sv_str(fields[0])[0] == '.') return MENU_LINE_END; //The end of the menu, per RFC 1436
+    for (size_t i = numFields; i < MENU_LINE_FIELDS; i++)
+    {
+        fields[i] = fallbacks[i];
+    }
+    entity->type = sv_str(fields[0])[0];
+    entity->displayName = numFields > 1 || sv_len(fields[0]) > 1
+            ? sv_borrow(sv_str(fields[0]) + 1, sv_len(fields[0]) - 1)
+            : sv_borrow("Undefined Name", 14);
+    entity->selector = fields[1];
+    entity->hostId = hi_intern_n(sv_str(fields[2]), sv_len(fields[2]));
+    entity->host = hi_name(entity->hostId);
+    entity->port = (int)strtol(sv_str(fields[3]), nullptr, 10);
+    entity->prefetchedData = nullptr;
+    return MENU_LINE_ENTITY;
+}
+
+//Every line holds at most one entity, so counting them first lets one allocation cover them all
+static size_t count_menu_lines(const char *start, const char *end)
+{
+    size_t numLines = 1;
+    for (const char *c = start; (c = memchr(c, '\n', end - c)) != nullptr; c++) numLines++;
+    return numLines;
+}
+
+//Allocates an entity array from the arena, or from the heap if there isn't one
+static gopherEntity *alloc_menu_entities(memArena *arena, size_t count)
+{
+    if (arena == nullptr) return calloc(count, sizeof(gopherEntity));
+    return ma_alloc(arena, count * sizeof(gopherEntity), alignof(gopherEntity));
+}
+
+/*
+ Parses every line between start and end in place into entities, which must have room for one per line,
+ and returns how many there were. Stops early at the line that ends the menu, in which case reachedEnd is set.
+ */
+static size_t parse_menu_lines(char *start, char *end, gopherEntity *entities, bool *reachedEnd)
+{
+    size_t numEntities = 0;
+    *reachedEnd = false;
+    for (char *line = start; line < end;)
+    {
+        enum menuLine kind = parse_menu_line(line, end, &entities[numEntities], &line);
+        if (kind == MENU_LINE_END)
+        {
+            *reachedEnd = true;
+            break;
+        }
+        if (kind == MENU_LINE_ENTITY) numEntities++;
+    }
+    return numEntities;
+}
+
+//Worker threads shared by every large menu, started the first time one is parsed
+static struct
+{
+    once_flag initFlag;
+    threadPool *pool;
+    size_t numThreads;
+} parsePool = { .initFlag = ONCE_FLAG_INIT };
+
+static void init_parse_pool()
+{
+    long numCores = 1;
+#if defined(__unix__) || (defined(__APPLE__) && defined(__MACH__))
+    numCores = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    //The thread asking for the parse works on the first piece itself
+    parsePool.numThreads = numCores > 1 ? (size_t)numCores - 1 : 0;
+    if (parsePool.numThreads > GOPHER_PARALLEL_PARSE_MAX_THREADS) parsePool.numThreads = GOPHER_PARALLEL_PARSE_MAX_THREADS;
+    if (parsePool.numThreads > 0) parsePool.pool = tp_new(parsePool.numThreads);
+}
+
+/*
+ Tracks the pieces of a menu that are being parsed on the pool.
+ */
+struct menuChunkGroup
+{
+    mtx_t mutex;
+    cnd_t finished;
+    size_t numRemaining;
+};
+
+/*
+ One piece of a menu, which always starts at the beginning of a line and ends just after a line feed
+ (or at the end of the menu), so it can be parsed without knowing anything about the others.
+ */
+struct menuChunk
+{
+    char *start;
+    char *end;
+    gopherEntity *entities;
+    size_t numEntities;
+    bool reachedEnd;
+    struct menuChunkGroup *group;
+};
+
+static void parse_menu_chunk_entities(struct menuChunk *chunk)
+{
+    //Arenas aren't thread-safe, so the pieces go on the heap until they are put back together
+    chunk->entities = calloc(count_menu_lines(chunk->start, chunk->end), sizeof(gopherEntity));
+    chunk->numEntities = parse_menu_lines(chunk->start, chunk->end, chunk->entities, &chunk->reachedEnd);
+}
+
+static void parse_menu_chunk(void *arg)
+{
+    struct menuChunk *chunk = arg;
+    parse_menu_chunk_entities(chunk);
+    mtx_lock(&chunk->group->mutex);
+    if (--chunk->group->numRemaining == 0) cnd_signal(&chunk->group->finished);
+    mtx_unlock(&chunk->group->mutex);
+}
+
+/*
+ Splits the menu text into as many pieces as there are threads to parse them, parses them all at once,
+ and puts the entities back together in order. Returns false without touching anything if the text is too small
+ to be worth splitting up.
+ */
+static bool parse_menu_parallel(gopherMenu *menu, char *text, char *end, memArena *arena)
+{
+    call_once(&parsePool.initFlag, init_parse_pool);
+    size_t length = end - text;
+    size_t numChunks = length / GOPHER_PARALLEL_PARSE_MIN_CHUNK;
+    if (numChunks > parsePool.numThreads + 1) numChunks = parsePool.numThreads + 1;
+    if (numChunks < 2) return false;
+
+    struct menuChunkGroup group = { .numRemaining = numChunks - 1 };
+    mtx_init(&group.mutex, mtx_plain);
+    cnd_init(&group.finished);
+    struct menuChunk *chunks = calloc(numChunks, sizeof(struct menuChunk));
+    char *chunkStart = text;
+    for (size_t i = 0; i < numChunks; i++)
+    {
+        char *chunkEnd = end;
+        if (i + 1 < numChunks)
+        {
+            //Split just after the first line feed past the even share, so no line is cut in two
+            char *target = text + length / numChunks * (i + 1);
+            if (target < chunkStart) target = chunkStart;
+            char *lineFeed = memchr(target, '\n', end - target);
+            chunkEnd = lineFeed != nullptr ? lineFeed + 1 : end;
+        }
+        chunks[i] = (struct menuChunk) { .start = chunkStart, .end = chunkEnd, .group = &group };
+        chunkStart = chunkEnd;
+    }
+    for (size_t i = 1; i < numChunks; i++)
+    {
+        tp_submit(parsePool.pool, parse_menu_chunk, &chunks[i]);
+    }
+    parse_menu_chunk_entities(&chunks[0]);
+    mtx_lock(&group.mutex);
+    while (group.numRemaining > 0) cnd_wait(&group.finished, &group.mutex);
+    mtx_unlock(&group.mutex);
+
+    //Anything after the line that ends the menu is ignored, like it is when parsing on one thread
+    size_t numUsed = numChunks;
+    size_t numEntities = 0;
+    for (size_t i = 0; i < numChunks; i++)
+    {
+        numEntities += chunks[i].numEntities;
+        if (chunks[i].reachedEnd)
+        {
+            numUsed = i + 1;
+            break;
+        }
+    }
+    menu->entities = alloc_menu_entities(arena, numEntities > 0 ? numEntities : 1);
+    menu->numEntities = 0;
+    for (size_t i = 0; i < numChunks; i++)
+    {
+        if (i < numUsed)
+        {
+            memcpy(menu->entities + menu->numEntities, chunks[i].entities, chunks[i].numEntities * sizeof(gopherEntity));
+            menu->numEntities += chunks[i].numEntities;
+        }
+        free(chunks[i].entities);
+    }
+    free(chunks);
+    mtx_destroy(&group.mutex);
+    cnd_destroy(&group.finished);
+    return true;
+}
+
+static gopherMenu parse_menu_buffer(resizableBuffer *source, memArena *arena)
+{
+    gopherMenu menu = { .entities = nullptr, .numEntities = 0, .freed = false, .prefetch = nullptr, .source = *source,
+                        .arena = arena };
+    *source = RB_EMPTY;
+    if (!bp_reserve(&menu.source, 1))
+    {
+        bp_return(&menu.source);
+        return menu;
+    }
+    //The arena frees the response if it can't take it on
+    if (arena != nullptr && !ma_adopt_buffer(arena, menu.source))
+    {
+        menu.source = RB_EMPTY;
+        return menu;
+    }
+    char *text = menu.source.contents;
+    char *end = text + menu.source.count;
+    *end = '\0';
+
+    if (menu.source.count >= GOPHER_PARALLEL_PARSE_THRESHOLD && parse_menu_parallel(&menu, text, end, arena)) return menu;
+    bool reachedEnd;
+    menu.entities = alloc_menu_entities(arena, count_menu_lines(text, end));
+    menu.numEntities = parse_menu_lines(text, end, menu.entities, &reachedEnd);
+    return menu;
+}
+
+gopherMenu parse_gopher_menu_from_buffer(resizableBuffer *source)
+{
+    return parse_menu_buffer(source, nullptr);
+}
+
+gopherMenu parse_gopher_menu_in_arena(resizableBuffer *source, memArena *arena)
+{
+    return parse_menu_buffer(source, arena);
+}
+
+gopherMenuParser gopher_menu_parser_new(gopherEntityCallback onEntity, void *userData)
+{
+    return (gopherMenuParser) { .line = RB_EMPTY, .finished = false, .numEntities = 0, .onEntity = onEntity, .userData = userData };
+}
+
+//Parses the line collected so far and hands the entity on, if it describes one
+static void gopher_menu_parser_emit_line(gopherMenuParser *parser)
+{
+    if (!rb_reserve(&parser->line, 1))
+    {
+        parser->line.count = 0;
+        return;
+    }
+    char *line = parser->line.contents;
+    char *end = line + parser->line.count;
+    *end = '\0';
+    gopherEntity entity;
+    char *next;
+    enum menuLine kind = parse_menu_line(line, end, &entity, &next);
+    parser->line.count = 0; //The contents stay put until the next piece is fed in
+    if (kind == MENU_LINE_END) parser->finished = true;
+    else if (kind == MENU_LINE_ENTITY)
+    {
+        parser->numEntities++;
+        parser->onEntity(&entity, parser->userData);
+    }
+}
+
+void gopher_menu_parser_feed(gopherMenuParser *parser, const char *data, size_t length)
+{
+    const char *end = data + length;
+    while (!parser->finished && data < end)
+    {
+        const char *lineFeed = memchr(data, '\n', end - data);
+        const char *lineEnd = lineFeed != nullptr ? lineFeed + 1 : end;
+        //The chunk belongs to the network code, so lines are split up in a copy of their own
+        if (!rb_append(&parser->line, lineEnd - data, (void *)data))
+        {
+            //Out of memory, so the rest of the menu is dropped rather than parsed with lines missing
+            parser->finished = true;
+            return;
+        }
+        data = lineEnd;
+        if (lineFeed == nullptr) return; //The rest of the line is in the next piece
+        gopher_menu_parser_emit_line(parser);
+    }
+}
+
+void gopher_menu_parser_finish(gopherMenuParser *parser)
+{
+    if (!parser->finished && parser->line.count > 0) gopher_menu_parser_emit_line(parser);
+    parser->finished = true;
+}
+
+void gopher_menu_parser_free(gopherMenuParser *parser)
+{
+    rb_free(&parser->line);
+}
+
+bool gopher_entity_needs_prefetch(gopherEntityType type)
+{
+    switch (type)
+    {
+        case GOPHER_ENTITY_IMAGE:
+        case GOPHER_NS_ENTITY_IMAGE:
+        case GOPHER_ENTITY_GIF:
+        case GOPHER_P_ENTITY_BMP:
+            return true;
+        default:
+            return false;
+    }
+}
+
+struct prefetchTarget
+{
+    gopherPrefetch *prefetch;
+    size_t entityIndex;
+    fetchRequest *request;
+};
+
+struct gopherPrefetch
+{
+    mtx_t mutex;
+    cnd_t progress;
+    gopherEntity *entities;
+    size_t numTargets;
+    size_t numCompleted;
+    struct prefetchTarget *targets;
+    fetchRequest **requestsByEntity; //nullptr for entities that aren't being prefetched
+    gopherPrefetchCallback onEntityReady;
+    void *userData;
+};
+
+static void gopher_prefetch_complete(fetchRequest *request, void *userData)
+{
+    struct prefetchTarget *target = userData;
+    gopherPrefetch *prefetch = target->prefetch;
+    gopherEntity *entity = &prefetch->entities[target->entityIndex];
+    //Entities linking to the same resource end up holding references to the same buffer
+    entity->prefetchedData = fe_share_result(request);
+    if (prefetch->onEntityReady != nullptr) prefetch->onEntityReady(entity, target->entityIndex, prefetch->userData);
+    //Once the last one is counted, the prefetch may be freed out from under us
+    mtx_lock(&prefetch->mutex);
+    prefetch->numCompleted++;
+    cnd_broadcast(&prefetch->progress);
+    mtx_unlock(&prefetch->mutex);
+}
+
+void gopher_menu_prefetch_start(gopherMenu *menu, const fetchOptions *options, gopherPrefetchCallback onEntityReady,
+                                void *userData)
+{
+    size_t numTargets = 0;
+    for (size_t i = 0; i < menu->numEntities; i++)
+    {
+        if (gopher_entity_needs_prefetch(menu->entities[i].type)) numTargets++;
+    }
+    //Start resolving every distinct host the menu links to at once, so the lookups overlap with each other
+    //and with the image fetches, and following a link later doesn't have to wait for DNS.
+    //Every host in the menu is interned by now, so one bit per id tells whether it's been seen.
+    size_t numHosts = hi_count() + 1;
+    unsigned char *seenHosts = calloc((numHosts + 7) / 8, 1);
+    for (size_t i = 0; i < menu->numEntities; i++)
+    {
+        gopherEntity *entity = &menu->entities[i];
+        if (entity->type == GOPHER_NS_ENTITY_INFO_MESSAGE || entity->type == GOPHER_ENTITY_ERROR) continue;
+        hostId id = entity->hostId;
+        if (seenHosts != nullptr && id < numHosts)
+        {
+            if (seenHosts[id / 8] & (1u << (id % 8))) continue;
+            seenHosts[id / 8] |= 1u << (id % 8);
+        }
+        resolve_prefetch_id(id);
+    }
+    free(seenHosts);
+    if (numTargets == 0) return;
+
+    gopherPrefetch *prefetch = calloc(1, sizeof(gopherPrefetch));
+    mtx_init(&prefetch->mutex, mtx_plain);
+    cnd_init(&prefetch->progress);
+    prefetch->entities = menu->entities;
+    prefetch->numTargets = numTargets;
+    prefetch->targets = calloc(numTargets, sizeof(struct prefetchTarget));
+    prefetch->requestsByEntity = calloc(menu->numEntities, sizeof(fetchRequest *));
+    prefetch->onEntityReady = onEntityReady;
+    prefetch->userData = userData;
+    menu->prefetch = prefetch;
+
+    //The engine holds each host to its connection limit and starts things in priority order,
+    //so everything can be handed over at once
+    fetchOptions targetOptions = options != nullptr ? *options : FETCH_OPTIONS_DEFAULT;
+    mtx_lock(&prefetch->mutex);
+    for (size_t i = 0, t = 0; i < menu->numEntities; i++)
+    {
+        gopherEntity *entity = &menu->entities[i];
+        if (!gopher_entity_needs_prefetch(entity->type)) continue;
+        struct prefetchTarget *target = &prefetch->targets[t++];
+        *target = (struct prefetchTarget) { .prefetch = prefetch, .entityIndex = i };
+        //Until the UI tells us what's actually on screen, guess that it's the top of the menu
+        targetOptions.priority = i < GOPHER_PREFETCH_VISIBLE_ESTIMATE ? FETCH_PRIORITY_VISIBLE : FETCH_PRIORITY_SPECULATIVE;
+        target->request = fe_submit_ex(sv_str(entity->host), sv_str(entity->selector), entity->port, &targetOptions,
+                                       gopher_prefetch_complete, target);
+        prefetch->requestsByEntity[i] = target->request;
+    }
+    mtx_unlock(&prefetch->mutex);
+}
+
+void gopher_menu_prefetch_set_priority(gopherMenu *menu, size_t entityIndex, fetchPriority priority)
+{
+    gopherPrefetch *prefetch = menu->prefetch;
+    if (prefetch == nullptr || entityIndex >= menu->numEntities) return;
+    mtx_lock(&prefetch->mutex);
+    fetchRequest *request = prefetch->requestsByEntity[entityIndex];
+    if (request != nullptr) fe_set_priority(request, priority);
+    mtx_unlock(&prefetch->mutex);
+}
+
+void gopher_menu_prefetch_wait(gopherMenu *menu)
+{
+    gopherPrefetch *prefetch = menu->prefetch;
+    if (prefetch == nullptr) return;
+    mtx_lock(&prefetch->mutex);
+    while (prefetch->numCompleted < prefetch->numTargets) cnd_wait(&prefetch->progress, &prefetch->mutex);
+    mtx_unlock(&prefetch->mutex);
+}
+
+void gopher_menu_prefetch(gopherMenu *menu, const fetchOptions *options)
+{
+    gopher_menu_prefetch_start(menu, options, nullptr, nullptr);
+    gopher_menu_prefetch_wait(menu);
+}
+
+static void gopher_prefetch_free(gopherPrefetch *prefetch)
+{
+    for (size_t t = 0; t < prefetch->numTargets; t++)
+    {
+        fe_release(prefetch->targets[t].request);
+    }
+    cnd_destroy(&prefetch->progress);
+    mtx_destroy(&prefetch->mutex);
+    free(prefetch->requestsByEntity);
+    free(prefetch->targets);
+    free(prefetch);
 }
 
 void gopher_menu_free(gopherMenu *menu)
 {
     if (menu->freed) return;
     menu->freed = true;
+    if (menu->prefetch != nullptr)
+    {
+        //Callbacks still to come would write into the entities
+        gopher_menu_prefetch_wait(menu);
+        gopher_prefetch_free(menu->prefetch);
+        menu->prefetch = nullptr;
+    }
+    bool borrowed = menu->source.contents != nullptr;
+    if (menu->arena != nullptr)
+    {
+        //Everything else goes when the arena is reset
+        for (size_t i = 0; i < menu->numEntities; i++)
+        {
+            srb_release(menu->entities[i].prefetchedData);
+            menu->entities[i].prefetchedData = nullptr;
+        }
+        menu->source = RB_EMPTY;
+        return;
+    }
     for (size_t i = 0; i < menu->numEntities; i++)
     {
-        gopher_entity_free(&menu->entities[i]);
+        if (!borrowed) gopher_entity_free(&menu->entities[i]);
+        else
+        {
+            //The names and selectors are all part of the source buffer, and the hosts are interned
+            srb_release(menu->entities[i].prefetchedData);
+            menu->entities[i].prefetchedData = nullptr;
+        }
     }
-    if (menu->numEntities > 0) free(menu->entities);
+    if (menu->numEntities > 0 || borrowed) free(menu->entities);
+    bp_return(&menu->source);
 }
 
 const char *get_string_gopher_type(gopherEntityType type)
@@ -11,8 +11,20 @@
 #include <ctype.h>
 #include <string.h>
 #include <stdatomic.h>
+#include <threads.h>
 #include "buffer-utils.h"
 #include "string_utils.h"
+#include "fetch-engine.h"
+#include "host-intern.h"
+
+//Number of entities at the top of a menu assumed to be on screen, until the UI says otherwise
+#define GOPHER_PREFETCH_VISIBLE_ESTIMATE 40
+//Menus at least this many bytes long are split up and parsed on several threads at once
+#define GOPHER_PARALLEL_PARSE_THRESHOLD (1024 * 1024)
+//Smallest piece of a menu worth handing to another thread
+#define GOPHER_PARALLEL_PARSE_MIN_CHUNK (256 * 1024)
+//Most threads that will be started to parse menus, besides the one asking
+#define GOPHER_PARALLEL_PARSE_MAX_THREADS 7
 
 /*
  Defines the various types used when defining entities in a Gopher directory.
@@ -62,11 +74,17 @@ typedef struct gopherEntity
     stringView displayName; //In RFC 1436, this is referred to as User_Name.
                             //I have elected to change this, as that term often refers to a very different concept.
     stringView selector;
-    stringView host;
+    stringView host; //The interned name(see hi_name), shared with every other entity on the same host and never freed
+    hostId hostId;
     int port;
-    resizableBuffer prefetchedData;
+    sharedBuffer *prefetchedData; //nullptr unless the entity was prefetched successfully. May be shared with other entities.
 } gopherEntity;
 
+/*
+ Progress of the prefetches a menu has started.
+ */
+typedef struct gopherPrefetch gopherPrefetch;
+
 /*
  Defines a Gopher menu.
  The menu structure is used for the entirety of a Gopher page.
@@ -76,8 +94,37 @@ typedef struct gopherMenu
     atomic_bool freed;
     size_t numEntities;
     gopherEntity *entities;
+    gopherPrefetch *prefetch; //nullptr unless a prefetch has been started
+    resizableBuffer source; //The response the entities' strings point into, if parsed with parse_gopher_menu_from_buffer
+    memArena *arena; //Owns the entity array and the source, if parsed with parse_gopher_menu_in_arena
 } gopherMenu;
 
+/*
+ Called once the fetch for a prefetched entity has finished, successfully or not, after its prefetchedData is filled in.
+ Runs on the fetch engine's I/O thread.
+ */
+typedef void (*gopherPrefetchCallback)(gopherEntity *entity, size_t entityIndex, void *userData);
+
+/*
+ Called by a gopherMenuParser for each entity as soon as its line is complete.
+ The entity's strings are only valid until the callback returns, so anything that is kept must be copied.
+ */
+typedef void (*gopherEntityCallback)(gopherEntity *entity, void *userData);
+
+/*
+ Incremental menu parser for responses that arrive a piece at a time, e.g. through fetchOptions.onChunk.
+ Lines may be split across pieces at any point. Should be created with gopher_menu_parser_new
+ and freed with gopher_menu_parser_free.
+ */
+typedef struct gopherMenuParser
+{
+    resizableBuffer line; //The incomplete line carried over from the previous piece
+    bool finished; //Set once the "." line that ends the menu has been seen; anything after it is ignored
+    size_t numEntities; //How many have been passed to onEntity so far
+    gopherEntityCallback onEntity;
+    void *userData;
+} gopherMenuParser;
+
 /*
  Gets the first full Gopher token starting at (source + currentPosition).
  */
@@ -95,17 +142,106 @@ void gopher_entity_free(gopherEntity *entity);
 
 /*
  Creates a Gopher menu structure from the given source text.
+ Any images the menu references are prefetched before it returns.
  */
 gopherMenu parse_gopher_menu(const char *source);
 
+/*
+ Same as parse_gopher_menu, but the images are fetched with the specified options(e.g. to make them cancellable).
+ prefetchOptions may be nullptr.
+ */
+gopherMenu parse_gopher_menu_ex(const char *source, const fetchOptions *prefetchOptions);
+
+/*
+ Creates a Gopher menu structure from the given source text without fetching anything.
+ */
+gopherMenu parse_gopher_menu_without_prefetch(const char *source);
+
+/*
+ Creates a Gopher menu structure from a response buffer without copying any of it, and without fetching anything.
+ The menu takes over the buffer, leaving source empty, and splits it into fields in place:
+ the entities' display names and selectors are slices of it, and are freed along with it by gopher_menu_free.
+ Responses of GOPHER_PARALLEL_PARSE_THRESHOLD bytes or more are split at line breaks and the pieces parsed
+ on a pool of worker threads, one per core, with the entities coming out in the same order either way.
+ */
+gopherMenu parse_gopher_menu_from_buffer(resizableBuffer *source);
+
+/*
+ Same as parse_gopher_menu_from_buffer, but the entity array is allocated from the arena,
+ and the arena takes over the source buffer, so gopher_menu_free only has the prefetched data left to release
+ and resetting the arena frees the rest.
+ */
+gopherMenu parse_gopher_menu_in_arena(resizableBuffer *source, memArena *arena);
+
+/*
+ Creates a parser that passes each entity to onEntity as soon as the line describing it has been fed in.
+ */
+gopherMenuParser gopher_menu_parser_new(gopherEntityCallback onEntity, void *userData);
+
+/*
+ Parses the next length bytes of the menu, calling the parser's onEntity for every line they complete.
+ */
+void gopher_menu_parser_feed(gopherMenuParser *parser, const char *data, size_t length);
+
+/*
+ Parses whatever is left over once the whole response has been fed in, in case its last line had no line break.
+ */
+void gopher_menu_parser_finish(gopherMenuParser *parser);
+
+/*
+ Frees the heap memory associated with a gopherMenuParser.
+ */
+void gopher_menu_parser_free(gopherMenuParser *parser);
+
+/*
+ Determines whether entities of the given type have their contents fetched along with the menu.
+ */
+bool gopher_entity_needs_prefetch(gopherEntityType type);
+
+/*
+ Starts fetching the contents of every image entity in the menu and returns immediately,
+ filling in each entity's prefetchedData as its fetch finishes.
+ Entities near the top of the menu are fetched at FETCH_PRIORITY_VISIBLE and the rest at FETCH_PRIORITY_SPECULATIVE;
+ the priority in options is ignored. options and onEntityReady may be nullptr.
+ */
+void gopher_menu_prefetch_start(gopherMenu *menu, const fetchOptions *options, gopherPrefetchCallback onEntityReady,
+                                void *userData);
+
+/*
+ Changes how urgently the specified entity's prefetch is needed, e.g. as it scrolls into or out of view.
+ Has no effect on entities that aren't being prefetched, or whose fetch has already connected.
+ */
+void gopher_menu_prefetch_set_priority(gopherMenu *menu, size_t entityIndex, fetchPriority priority);
+
+/*
+ Waits until every prefetch the menu started has completed, timed out or been cancelled.
+ */
+void gopher_menu_prefetch_wait(gopherMenu *menu);
+
+/*
+ Fetches the contents of every image entity in the menu concurrently,
+ filling in each entity's prefetchedData as its fetch finishes.
+ Returns once all of them have completed, timed out or been cancelled through options->cancelToken.
+ options may be nullptr.
+ */
+void gopher_menu_prefetch(gopherMenu *menu, const fetchOptions *options);
+
 /*
  Frees the heap memory associated with a Gopher menu and its child entities.
+ Waits for any prefetches still running, so cancel them first.
  */
 void gopher_menu_free(gopherMenu *menu);
 
 /*
- Parses a text file in the gopher format into a stringBuilder, stripping out any periods on their own line.
+ Parses a text file in the gopher format into a stringBuilder, removing the period doubled at the start of a line
+ and stopping at the line with only a period on it.
  */
 stringBuilder parse_gopher_textfile(const char *buf, size_t bufSize);
 
+/*
+ Same as parse_gopher_textfile, but works in place on a response buffer instead of copying it.
+ The stringBuilder takes over the buffer's memory, leaving source empty, so it is freed with sb_free.
+ */
+stringBuilder parse_gopher_textfile_from_buffer(resizableBuffer *source);
+
 #endif //GOPHERBROWSER_GOPHER_PROTOCOL_H
\ No newline at end of file
@@ -0,0 +1,154 @@
+/*
+*  This Source Code Form is subject to the terms of the Mozilla Public
+*  License, v. 2.0. If a copy of the MPL was not distributed with this
+*  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#include "host-intern.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <stdatomic.h>
+#include <threads.h>
+
+//Number of slots the hash table starts with. Must be a power of two.
+#define HI_INITIAL_SLOTS 64
+
+struct internedHost
+{
+    stringView name;
+    uint64_t hash;
+};
+
+/*
+ Names are stored in fixed-size pages that never move once allocated,
+ so looking one up by id needs no lock even while the table is growing.
+ The hash table from names to ids is only touched with the mutex held.
+ */
+static struct
+{
+    once_flag initFlag;
+    mtx_t mutex;
+    atomic_size_t numHosts; //Including HOST_ID_NONE
+    size_t numSlots;
+    hostId *slots; //HOST_ID_NONE for an empty slot
+    struct internedHost *_Atomic pages[HI_MAX_PAGES];
+} hostTable = { .initFlag = ONCE_FLAG_INIT };
+
+//Most callers intern the same host many times in a row(e.g. every line of a menu), so each thread remembers its last one
+static thread_local hostId lastInterned = HOST_ID_NONE;
+
+static void hi_init()
+{
+    mtx_init(&hostTable.mutex, mtx_plain);
+    hostTable.numSlots = HI_INITIAL_SLOTS;
+    hostTable.slots = calloc(hostTable.numSlots, sizeof(hostId));
+    struct internedHost *firstPage = calloc(HI_PAGE_SIZE, sizeof(struct internedHost));
+    firstPage[HOST_ID_NONE].name = sv_borrow("", 0);
+    atomic_store(&hostTable.pages[0], firstPage);
+    atomic_store(&hostTable.numHosts, 1);
+}
+
+static struct internedHost *hi_entry(hostId id)
+{
+    return &atomic_load_explicit(&hostTable.pages[id / HI_PAGE_SIZE], memory_order_acquire)[id & (HI_PAGE_SIZE - 1)];
+}
+
+static bool hi_matches(hostId id, const char *host, size_t length)
+{
+    stringView name = hi_entry(id)->name;
+    return sv_len(name) == length && strncasecmp(sv_str(name), host, length) == 0;
+}
+
+//FNV-1a over the lowercased name, since hostnames are case-insensitive
+static uint64_t hi_hash(const char *host, size_t length)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash = (hash ^ (uint64_t)tolower((unsigned char)host[i])) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+//Doubles the number of slots and puts every id back. The mutex must be held.
+static void hi_grow()
+{
+    size_t newNumSlots = hostTable.numSlots * 2;
+    hostId *newSlots = calloc(newNumSlots, sizeof(hostId));
+    size_t numHosts = atomic_load_explicit(&hostTable.numHosts, memory_order_relaxed);
+    for (hostId id = 1; id < numHosts; id++)
+    {
+        size_t slot = hi_entry(id)->hash & (newNumSlots - 1);
+        while (newSlots[slot] != HOST_ID_NONE) slot = (slot + 1) & (newNumSlots - 1);
+        newSlots[slot] = id;
+    }
+    free(hostTable.slots);
+    hostTable.slots = newSlots;
+    hostTable.numSlots = newNumSlots;
+}
+
+hostId hi_intern_n(const char *host, size_t length)
+{
+    if (lastInterned != HOST_ID_NONE && hi_matches(lastInterned, host, length)) return lastInterned;
+    call_once(&hostTable.initFlag, hi_init);
+    uint64_t hash = hi_hash(host, length);
+
+    mtx_lock(&hostTable.mutex);
+    size_t slot = hash & (hostTable.numSlots - 1);
+    for (; hostTable.slots[slot] != HOST_ID_NONE; slot = (slot + 1) & (hostTable.numSlots - 1))
+    {
+        hostId id = hostTable.slots[slot];
+        if (hi_entry(id)->hash == hash && hi_matches(id, host, length))
+        {
+            mtx_unlock(&hostTable.mutex);
+            return lastInterned = id;
+        }
+    }
+
+    hostId id = (hostId)atomic_load_explicit(&hostTable.numHosts, memory_order_relaxed);
+    if (id / HI_PAGE_SIZE >= HI_MAX_PAGES)
+    {
+        mtx_unlock(&hostTable.mutex);
+        fprintf(stderr, "Could not intern host %.*s: too many distinct hosts\n", (int)length, host);
+        return HOST_ID_NONE;
+    }
+    if (atomic_load_explicit(&hostTable.pages[id / HI_PAGE_SIZE], memory_order_relaxed) == nullptr)
+        atomic_store_explicit(&hostTable.pages[id / HI_PAGE_SIZE], calloc(HI_PAGE_SIZE, sizeof(struct internedHost)),
+                              memory_order_release);
+    char *name = malloc(length + 1);
+    memcpy(name, host, length);
+    name[length] = '\0';
+    *hi_entry(id) = (struct internedHost) { .name = sv_borrow(name, length), .hash = hash };
+    hostTable.slots[slot] = id;
+    atomic_store_explicit(&hostTable.numHosts, id + 1, memory_order_release);
+    //Keep the table at most half full, so probe sequences stay short
+    if ((id + 1) * 2 > hostTable.numSlots) hi_grow();
+    mtx_unlock(&hostTable.mutex);
+    return lastInterned = id;
+}
+
+hostId hi_intern(const char *host)
+{
+    return hi_intern_n(host, strlen(host));
+}
+
+stringView hi_name(hostId id)
+{
+    call_once(&hostTable.initFlag, hi_init);
+    return hi_entry(id)->name;
+}
+
+const char *hi_str(hostId id)
+{
+    call_once(&hostTable.initFlag, hi_init);
+    return sv_str(hi_entry(id)->name);
+}
+
+size_t hi_count()
+{
+    call_once(&hostTable.initFlag, hi_init);
+    return atomic_load(&hostTable.numHosts) - 1;
+}
\ No newline at end of file
@@ -0,0 +1,55 @@
+/*
+*  This Source Code Form is subject to the terms of the Mozilla Public
+*  License, v. 2.0. If a copy of the MPL was not distributed with this
+*  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#ifndef GOPHERBROWSER_HOST_INTERN_H
+#define GOPHERBROWSER_HOST_INTERN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "string_utils.h"
+
+//Number of names held by each page of the table. Must be a power of two.
+#define HI_PAGE_SIZE 256
+//Number of pages the table can grow to, which limits how many distinct hosts there can be
+#define HI_MAX_PAGES 16384
+
+/*
+ Small integer standing for a hostname, the same for every spelling of it that differs only in case.
+ Ids are handed out in sequence starting from 1, so they can index tables directly.
+ */
+typedef uint32_t hostId;
+
+//Never given to a host; its name is the empty string
+#define HOST_ID_NONE 0
+
+/*
+ Gets the id for the host, adding it to the process-wide table if it hasn't been seen before.
+ Safe to call from any thread. Returns HOST_ID_NONE only if the table is full.
+ */
+hostId hi_intern(const char *host);
+
+/*
+ Same as hi_intern, but for a host that isn't null-terminated.
+ */
+hostId hi_intern_n(const char *host, size_t length);
+
+/*
+ Gets the name of a host, spelled the way it was first interned.
+ The name is never freed or moved, so it can be held onto for as long as the process runs.
+ */
+stringView hi_name(hostId id);
+
+/*
+ Same as hi_name, but gets the name as a null-terminated string.
+ */
+const char *hi_str(hostId id);
+
+/*
+ Gets the number of distinct hosts interned so far.
+ */
+size_t hi_count();
+
+#endif //GOPHERBROWSER_HOST_INTERN_H
\ No newline at end of file
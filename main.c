@@ -7,6 +7,8 @@
 #include <stdio.h>
 #include <gtk/gtk.h>
 #include "ui.h"
+#include "fetch-timing.h"
+#include "buffer-pool.h"
 
 int main(int argc, char **argv)
 {
@@ -18,5 +20,10 @@ int main(int argc, char **argv)
     status = g_application_run(G_APPLICATION (app), argc, argv);
     g_object_unref(app);
 
+#ifdef ROWER_NETWORK_DEBUG
+    ft_dump_histograms(stderr);
+    bp_dump_stats(stderr);
+#endif
+
     return status;
 }
\ No newline at end of file
@@ -4,7 +4,13 @@
 *  file, You can obtain one at http://mozilla.org/MPL/2.0/.
 */
 
+#if defined(__linux__)
+#define _GNU_SOURCE //For splice and pipe2
+#endif
+
 #include "network-interface.h"
+#include "fetch-engine.h"
+#include "resolver.h"
 #include "string_utils.h"
 
 //Only compile this part on Unix systems--
@@ -22,66 +28,11 @@
 #include <sys/socket.h>
 #include <errno.h>
 #include <netdb.h>
+#include <sys/time.h>
+#include <fcntl.h>
+#include <time.h>
 #include <threads.h>
 
-struct addrCacheEntry
-{
-    stringView hostname;
-    struct sockaddr_in addr;
-};
-
-static struct
-{
-    atomic_bool isInitialized;
-    mtx_t mutex;
-    size_t entryCap;
-    size_t numEntries;
-    struct addrCacheEntry *entries;
-} addrCache = { 0 };
-
-inline void init_addr_cache()
-{
-    if (addrCache.isInitialized) return;
-    addrCache.isInitialized = true;
-    mtx_init(&addrCache.mutex, mtx_plain);
-    addrCache.entryCap = DEFAULT_DNS_CACHE_SIZE;
-    addrCache.numEntries = 0;
-    addrCache.entries = calloc(addrCache.entryCap, sizeof(struct addrCacheEntry));
-}
-void init_addr_cache();
-
-void addr_cache_add(const char *host, struct sockaddr_in entry)
-{
-    init_addr_cache();
-    mtx_lock(&addrCache.mutex);
-    addrCache.numEntries++;
-    if (addrCache.numEntries > addrCache.entryCap)
-    {
-        addrCache.entryCap *= 2;
-        void *newBuf = calloc(addrCache.entryCap, sizeof(struct addrCacheEntry));
-        memcpy(newBuf, addrCache.entries, (addrCache.numEntries - 1) * sizeof(struct addrCacheEntry));
-        free(addrCache.entries);
-        addrCache.entries = newBuf;
-    }
-    struct addrCacheEntry cacheEntry = { .addr = entry, .hostname = sv_new(host) };
-    addrCache.entries[addrCache.numEntries - 1] = cacheEntry;
-    mtx_unlock(&addrCache.mutex);
-}
-
-struct sockaddr_in addr_cache_get(const char *host)
-{
-    init_addr_cache();
-    mtx_lock(&addrCache.mutex);
-    struct sockaddr_in output = { 0 };
-    for (size_t i = 0; i < addrCache.numEntries; i++)
-    {
-        if (strcmp(addrCache.entries[i].hostname.contents, host) == 0)
-            output = addrCache.entries[i].addr;
-    }
-    mtx_unlock(&addrCache.mutex);
-    return output;
-}
-
 const char *get_ip_addr(const char * const host)
 {
     struct hostent *h = gethostbyname(host);
@@ -98,136 +49,200 @@ resizableBuffer get_gopher_page(const char *const host, const char * const selec
 }
 
 resizableBuffer get_gopher_page_ex(const char *const host, const char *const selector, int port)
+{
+    return get_gopher_page_with_options(host, selector, port, nullptr);
+}
+
+resizableBuffer get_gopher_page_with_options(const char *const host, const char *const selector, int port, const fetchOptions *options)
+{
+    return get_gopher_page_timed(host, selector, port, options).data;
+}
+
+fetchResult get_gopher_page_timed(const char *const host, const char *const selector, int port, const fetchOptions *options)
 {
 #ifdef ROWER_NETWORK_DEBUG
     fprintf(stderr, "Downloading %s:%d%s\n", host, port, selector);
 #endif
-    char buffer[DEFAULT_BUFFER_SIZE] = {0}; //Buffer for temporarily storing the data we receive
-    int32_t sock;
-
+    //The actual transaction runs on the fetch engine's I/O thread; we just wait for it here.
+    fetchResult output = fe_fetch_sync_timed(host, selector, port, options);
 
-    struct addrinfo hints = {0};
-    hints.ai_family = AF_INET;
-    hints.ai_socktype = SOCK_STREAM;
-    hints.ai_flags = AI_PASSIVE;
-
-    int error = 0;
-    struct
-    {
-        struct sockaddr_in addr;
-        in_port_t port;
-        int socktype;
-    } hostInfo = { .socktype = AF_INET, .port = htons(port) };
-    struct sockaddr_in addr = addr_cache_get(host);
-    if (addr.sin_port == 0)
-    {
-        fprintf(stderr, "DNS Cache Miss: %s\n", host);
-        struct addrinfo *servinfo = nullptr;
-        error = getaddrinfo(host, "gopher", &hints, &servinfo);
-        hostInfo.addr = *(struct sockaddr_in*)servinfo->ai_addr;
-        hostInfo.socktype = servinfo->ai_socktype;
-        addr_cache_add(host, hostInfo.addr);
-        freeaddrinfo(servinfo);
-    }
-    else
-    {
-        fprintf(stderr, "DNS Cache Hit: %s\n", host);
-        hostInfo.addr = addr;
-        hostInfo.socktype = SOCK_STREAM;
-    }
-
-    //((struct sockaddr_in*)servinfo->ai_addr)->sin_port = htons((uint16_t)port);
-
-    if (error != 0)
-    {
-        fprintf(stderr, "Could not load page %s%s\n", host, selector);
-        return RB_EMPTY;
-    }
+#ifdef ROWER_NETWORK_DEBUG
+    if (output.data.count == 0)
+        fprintf(stderr, "Warning: resource %s:%d%s downloaded 0 bytes\n", host, port, selector);
+    fprintf(stderr, "Timing for %s:%d%s: DNS %.2fms, connect %.2fms, first byte %.2fms, transfer %.2fms, %zu bytes in %zu recv calls\n",
+            host, port, selector, ft_phase_ns(&output.timing, FETCH_PHASE_DNS) / 1e6,
+            ft_phase_ns(&output.timing, FETCH_PHASE_CONNECT) / 1e6, ft_phase_ns(&output.timing, FETCH_PHASE_FIRST_BYTE) / 1e6,
+            ft_phase_ns(&output.timing, FETCH_PHASE_TRANSFER) / 1e6, output.timing.bytesReceived, output.timing.recvCalls);
+    if (output.timing.connectSaved != 0)
+        fprintf(stderr, "Used a pre-connected socket for %s:%d%s, saving %.2fms of connecting\n", host, port, selector,
+                output.timing.connectSaved / 1e6);
+#endif
 
-    sock = socket(AF_INET, hostInfo.socktype, IPPROTO_IP);
+    return output;
+}
 
-    error = connect(sock, (struct sockaddr *) &hostInfo.addr, sizeof(hostInfo.addr));
+#if defined(__linux__)
+/*
+ Moves everything the socket sends into the file through a pipe, without it ever being copied into userspace.
+ Returns the number of bytes written, or -1 if splice isn't usable here, in which case nothing has been consumed.
+ */
+static ssize_t download_splice(int sock, int fd, const char *host, fetchTiming *timing)
+{
+    int pipeFds[2];
+    if (pipe2(pipeFds, O_CLOEXEC) != 0) return -1;
+    //A bigger pipe means fewer round trips through the kernel; it's fine if we aren't allowed one
+    fcntl(pipeFds[1], F_SETPIPE_SZ, DOWNLOAD_BLOCK_SIZE);
 
-    if (error != 0)
+    ssize_t total = 0;
+    while (true)
     {
-        fprintf(stderr, "Could not establish connection to %s port %d: %s\n", host, port, strerror(errno));
-        return RB_EMPTY;
+        ssize_t len = splice(sock, nullptr, pipeFds[1], nullptr, DOWNLOAD_BLOCK_SIZE, SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (len == -1 && errno == EINTR) continue;
+        if (len == -1 && total == 0 && (errno == EINVAL || errno == ENOSYS))
+        {
+            total = -1; //Not supported for this socket or file system, so download_read_write does the receiving
+            break;
+        }
+        timing->recvCalls++;
+        if (len > 0 && timing->firstByte == 0) timing->firstByte = ft_now();
+        if (len == 0) break;
+        if (len == -1)
+        {
+            fprintf(stderr, "Could not receive data from %s: %s\n", host, strerror(errno));
+            break;
+        }
+        //Drain the pipe before reading any more, so it never fills up and stalls the socket side
+        while (len > 0)
+        {
+            ssize_t written = splice(pipeFds[0], nullptr, fd, nullptr, len, SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (written == -1 && errno == EINTR) continue;
+            if (written <= 0)
+            {
+                fprintf(stderr, "Could not write downloaded data: %s\n", strerror(errno));
+                close(pipeFds[0]);
+                close(pipeFds[1]);
+                return total;
+            }
+            len -= written;
+            total += written;
+        }
     }
-
-    stringBuilder initialMessage = sb_new_with_contents(selector);
-#ifdef EXPERIMENTAL_GOPHER_PLUS
-    sb_append_contents(&initialMessage, "\t+");
+    close(pipeFds[0]);
+    close(pipeFds[1]);
+    return total;
+}
 #endif
-    sb_append_contents(&initialMessage, "\r\n");
 
-    send(sock, initialMessage.contents, sb_len(initialMessage), 0);
-    sb_free(&initialMessage);
-
-    ssize_t len = recv(sock, buffer, DEFAULT_BUFFER_SIZE - 1, 0);
-    if (len == -1)
+//Copies everything the socket sends into the file in large blocks, for when splice isn't available
+static ssize_t download_read_write(int sock, int fd, const char *host, fetchTiming *timing)
+{
+    char *buffer = malloc(DOWNLOAD_BLOCK_SIZE);
+    if (buffer == nullptr)
     {
-        fprintf(stderr, "Could not receive data: %s", strerror(errno));
-        return RB_EMPTY;
+        fprintf(stderr, "Could not allocate a buffer to download from %s\n", host);
+        return 0;
     }
-    resizableBuffer output = rb_new(len);
-    rb_append(&output, len, buffer);
-    while (len != 0)
+    ssize_t total = 0;
+    while (true)
     {
-        len = recv(sock, buffer, DEFAULT_BUFFER_SIZE - 1, 0);
+        ssize_t len = recv(sock, buffer, DOWNLOAD_BLOCK_SIZE, 0);
+        if (len == -1 && errno == EINTR) continue;
+        timing->recvCalls++;
+        if (len > 0 && timing->firstByte == 0) timing->firstByte = ft_now();
+        if (len == 0) break;
         if (len == -1)
         {
-            fprintf(stderr, "Could not receive data: %s", strerror(errno));
-            return RB_EMPTY;
+            fprintf(stderr, "Could not receive data from %s: %s\n", host, strerror(errno));
+            break;
+        }
+        for (ssize_t offset = 0; offset < len;)
+        {
+            ssize_t written = write(fd, buffer + offset, len - offset);
+            if (written == -1 && errno == EINTR) continue;
+            if (written <= 0)
+            {
+                fprintf(stderr, "Could not write downloaded data: %s\n", strerror(errno));
+                free(buffer);
+                return total;
+            }
+            offset += written;
+            total += written;
         }
-        rb_append(&output, len, buffer);
     }
-    //len = recv(sock, buffer, DEFAULT_BUFFER_SIZE - 1, 0);
-
-
-    buffer[len] = '\0';
-
-    //printf("Received %s (%d bytes).\n", buffer, len);
-
-    close(sock);
+    free(buffer);
+    return total;
+}
 
-#ifdef ROWER_NETWORK_DEBUG
-    if (output.count == 0)
-        fprintf(stderr, "Warning: resource %s:%d%s downloaded 0 bytes\n", host, port, selector);
-#endif
+//Sends the whole request, however many calls that takes
+static bool download_send_all(int sock, const char *data, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t sent = send(sock, data, length, MSG_NOSIGNAL);
+        if (sent == -1 && errno == EINTR) continue;
+        if (sent <= 0) return false;
+        data += sent;
+        length -= sent;
+    }
+    return true;
+}
 
-    return output;
+//Every download is recorded, including the ones that fail, so the Total histogram sees them all
+static fetchTiming download_finish(fetchTiming timing)
+{
+    timing.end = ft_now();
+    ft_record(&timing);
+    return timing;
 }
 
 void download_file(const char *const host, const char *const selector, int port)
+{
+    download_file_timed(host, selector, port);
+}
+
+fetchTiming download_file_timed(const char *const host, const char *const selector, int port)
 {
     fprintf(stderr, "Downloading %s:%d%s\n", host, port, selector);
-    char buffer[DEFAULT_BUFFER_SIZE] = {0}; //Buffer for temporarily storing the data we receive
+    fetchTiming timing = { .start = ft_now() };
     int32_t sock;
 
-    struct addrinfo *servinfo = nullptr;
-    struct addrinfo hints = {0};
-    hints.ai_family = AF_UNSPEC;
-    hints.ai_socktype = SOCK_STREAM;
-    hints.ai_flags = AI_PASSIVE;
-
-    int error = getaddrinfo(host, "gopher", &hints, &servinfo);
-    ((struct sockaddr_in*)servinfo->ai_addr)->sin_port = htons((uint16_t)port);
+    //Going through the resolver means we share the DNS cache and any lookup already running for this host
+    dnsFuture *lookup = resolve_async(host);
+    addrList addrs;
+    bool resolved = dns_future_wait(lookup, &addrs);
+    dns_future_release(lookup);
+    timing.dnsEnd = ft_now();
 
-    if (error != 0)
+    if (!resolved)
     {
         fprintf(stderr, "Could not load page %s%s\n", host, selector);
-        return;
+        return download_finish(timing);
     }
+    resolvedAddr addr = addr_list_pick(&addrs, port);
 
-    sock = socket(servinfo->ai_family, servinfo->ai_socktype, servinfo->ai_protocol);
+    sock = socket(addr.addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock == -1)
+    {
+        fprintf(stderr, "Could not create a socket to connect to %s: %s\n", host, strerror(errno));
+        return download_finish(timing);
+    }
 
-    error = connect(sock, servinfo->ai_addr, servinfo->ai_addrlen);
+    //Blocking socket, so the deadlines are enforced by the kernel. On Linux the send timeout also bounds connect().
+    struct timeval connectTimeout = { .tv_sec = FE_DEFAULT_CONNECT_TIMEOUT_MS / 1000 };
+    struct timeval recvTimeout = { .tv_sec = FE_DEFAULT_FIRST_BYTE_TIMEOUT_MS / 1000 };
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &connectTimeout, sizeof(connectTimeout));
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &recvTimeout, sizeof(recvTimeout));
+
+    timing.connectStart = ft_now();
+    int error = connect(sock, (struct sockaddr *) &addr.addr, addr.addrLen);
 
     if (error != 0)
     {
         fprintf(stderr, "Could not establish connection to %s port %d: %s\n", host, port, strerror(errno));
-        return;
+        close(sock);
+        return download_finish(timing);
     }
+    timing.connectEnd = ft_now();
 
     const char *fileName = strchr(selector, '/');
     while (true)
@@ -243,11 +258,13 @@ void download_file(const char *const host, const char *const selector, int port)
     sb_append_contents(&filePath, "/Downloads");
     sb_append_contents(&filePath, fileName);
 #warning TODO: Add better checking to make sure the downloads folder exists dumbass
-    FILE *file = fopen(filePath.contents, "wb+");
-    if (file == nullptr)
+    int fd = open(filePath.contents, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1)
     {
         fprintf(stderr, "Could not open file %s: %s\n", filePath.contents, strerror(errno));
-        return;
+        sb_free(&filePath);
+        close(sock);
+        return download_finish(timing);
     }
 
     fprintf(stderr, "Saving downloaded file as %s\n", filePath.contents);
@@ -256,28 +273,31 @@ void download_file(const char *const host, const char *const selector, int port)
     stringBuilder initialMessage = sb_new_with_contents(selector);
     sb_append_contents(&initialMessage, "\r\n");
 
-    send(sock, initialMessage.contents, sb_len(initialMessage), 0);
-    sb_free(&initialMessage);
-
-    ssize_t len = recv(sock, buffer, DEFAULT_BUFFER_SIZE - 1, 0);
-    if (len == -1)
+    if (!download_send_all(sock, initialMessage.contents, sb_len(initialMessage)))
     {
-        fprintf(stderr, "Could not receive data: %s", strerror(errno));
-        return;
+        fprintf(stderr, "Could not send request to %s: %s\n", host, strerror(errno));
+        sb_free(&initialMessage);
+        close(fd);
+        close(sock);
+        return download_finish(timing);
     }
-    fwrite(buffer, 1, len, file);
+    timing.requestSent = ft_now();
+    sb_free(&initialMessage);
 
-    while (len != 0)
-    {
-        len = recv(sock, buffer, DEFAULT_BUFFER_SIZE - 1, 0);
-        if (len == -1)
-        {
-            fprintf(stderr, "Could not receive data: %s", strerror(errno));
-            return;
-        }
-        fwrite(buffer, 1, len, file);
-    }
-    fclose(file);
+    ssize_t total = -1;
+#if defined(__linux__)
+    total = download_splice(sock, fd, host, &timing);
+#endif
+    if (total == -1) total = download_read_write(sock, fd, host, &timing);
+    close(fd);
+    close(sock);
+    timing.bytesReceived = total;
+    timing = download_finish(timing);
+
+    double seconds = ft_phase_ns(&timing, FETCH_PHASE_TOTAL) / 1e9;
+    fprintf(stderr, "Downloaded %zd bytes from %s in %.2fs (%.2f MB/s)\n", total, host, seconds,
+            seconds > 0 ? (double)total / seconds / (1024 * 1024) : 0.0);
+    return timing;
 }
 
 #endif
\ No newline at end of file
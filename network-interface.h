@@ -8,11 +8,14 @@
 #define GOPHERBROWSER_NETWORK_INTERFACE_H
 
 #include "buffer-utils.h"
+#include "fetch-engine.h"
 
 #define GOPHER_PORT 70
 #define HTTP_PORT 80
 #define HTTPS_PORT 443
-#define DEFAULT_DNS_CACHE_SIZE 32
+
+//How much download_file moves from the socket to the file at a time
+#define DOWNLOAD_BLOCK_SIZE (1024 * 1024)
 
 enum GOPHER_SUPPORT
 {
@@ -28,6 +31,9 @@ void get_network_capabilities();
 resizableBuffer download_file_contents(const char *const host, const char *const uri);
 resizableBuffer get_gopher_page(const char *const host, const char *const selector);
 resizableBuffer get_gopher_page_ex(const char *const host, const char *const selector, int port);
+resizableBuffer get_gopher_page_with_options(const char *const host, const char *const selector, int port, const fetchOptions *options);
+fetchResult get_gopher_page_timed(const char *const host, const char *const selector, int port, const fetchOptions *options);
 void download_file(const char *const host, const char *const selector, int port);
+fetchTiming download_file_timed(const char *const host, const char *const selector, int port);
 
 #endif //GOPHERBROWSER_NETWORK_INTERFACE_H
\ No newline at end of file
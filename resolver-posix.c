@@ -0,0 +1,241 @@
+/*
+*  This Source Code Form is subject to the terms of the Mozilla Public
+*  License, v. 2.0. If a copy of the MPL was not distributed with this
+*  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#include "resolver.h"
+#include "thread-pool.h"
+
+#if defined(__unix__) || (defined(__APPLE__) && defined(__MACH__))
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <threads.h>
+#include <netdb.h>
+
+enum dnsFutureState
+{
+    DNS_FUTURE_PENDING,
+    DNS_FUTURE_RESOLVED,
+    DNS_FUTURE_FAILED
+};
+
+struct dnsWaiter
+{
+    dnsCallback callback;
+    void *userData;
+    struct dnsWaiter *next;
+};
+
+struct dnsFuture
+{
+    atomic_int refCount;
+    enum dnsFutureState state;
+    hostId host;
+    addrList addrs;
+    struct dnsWaiter *waiters;
+    struct dnsFuture *nextInFlight;
+};
+
+static struct
+{
+    once_flag initFlag;
+    mtx_t mutex;
+    cnd_t finished;
+    threadPool *pool;
+    struct dnsFuture *inFlight; //Lookups currently running, so duplicates can attach to them
+} resolver = { .initFlag = ONCE_FLAG_INIT };
+
+static void init_resolver()
+{
+    mtx_init(&resolver.mutex, mtx_plain);
+    cnd_init(&resolver.finished);
+    resolver.pool = tp_new(RESOLVER_DEFAULT_THREADS);
+}
+
+static dnsFuture *dns_future_new(hostId host, enum dnsFutureState state, int refCount)
+{
+    dnsFuture *future = calloc(1, sizeof(dnsFuture));
+    atomic_init(&future->refCount, refCount);
+    future->state = state;
+    future->host = host;
+    return future;
+}
+
+void dns_future_release(dnsFuture *future)
+{
+    if (future == nullptr) return;
+    if (atomic_fetch_sub(&future->refCount, 1) == 1)
+    {
+        free(future);
+    }
+}
+
+static void resolve_job(void *arg)
+{
+    dnsFuture *future = arg;
+    struct addrinfo hints = {0};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    struct addrinfo *servinfo = nullptr;
+    addrList addrs = { 0 };
+    int error = getaddrinfo(hi_str(future->host), "gopher", &hints, &servinfo);
+    if (error == 0) addrs = addr_list_from_addrinfo(servinfo);
+    if (servinfo != nullptr) freeaddrinfo(servinfo);
+    bool resolved = error == 0 && addrs.count > 0;
+    //The cache is updated before the future is taken out of the in-flight list, so there is no window
+    //in which a new request for this host would miss both and start a second lookup
+    if (resolved) addr_cache_add(future->host, &addrs, ADDR_CACHE_DEFAULT_TTL);
+    else addr_cache_add_negative(future->host, ADDR_CACHE_NEGATIVE_TTL);
+
+    mtx_lock(&resolver.mutex);
+    for (dnsFuture **link = &resolver.inFlight; *link != nullptr; link = &(*link)->nextInFlight)
+    {
+        if (*link == future)
+        {
+            *link = future->nextInFlight;
+            break;
+        }
+    }
+    future->addrs = addrs;
+    future->state = resolved ? DNS_FUTURE_RESOLVED : DNS_FUTURE_FAILED;
+    struct dnsWaiter *waiters = future->waiters;
+    future->waiters = nullptr;
+    cnd_broadcast(&resolver.finished);
+    mtx_unlock(&resolver.mutex);
+
+    while (waiters != nullptr)
+    {
+        struct dnsWaiter *next = waiters->next;
+        waiters->callback(future, waiters->userData);
+        free(waiters);
+        waiters = next;
+    }
+    dns_future_release(future); //The job's own reference
+}
+
+//Returns a completed future if the cache can answer for the host, or nullptr otherwise
+static dnsFuture *future_from_cache(hostId host)
+{
+    addrList addrs;
+    switch (addr_cache_get(host, &addrs))
+    {
+        case ADDR_CACHE_HIT:
+        {
+            fprintf(stderr, "DNS Cache Hit: %s\n", hi_str(host));
+            dnsFuture *future = dns_future_new(host, DNS_FUTURE_RESOLVED, 1);
+            future->addrs = addrs;
+            return future;
+        }
+        case ADDR_CACHE_NEGATIVE:
+            fprintf(stderr, "DNS Cache Hit(negative): %s\n", hi_str(host));
+            return dns_future_new(host, DNS_FUTURE_FAILED, 1);
+        default:
+            return nullptr;
+    }
+}
+
+dnsFuture *resolve_async(const char *host)
+{
+    return resolve_async_id(hi_intern(host));
+}
+
+dnsFuture *resolve_async_id(hostId host)
+{
+    call_once(&resolver.initFlag, init_resolver);
+    dnsFuture *future = future_from_cache(host);
+    if (future != nullptr) return future;
+
+    mtx_lock(&resolver.mutex);
+    for (future = resolver.inFlight; future != nullptr; future = future->nextInFlight)
+    {
+        if (future->host == host)
+        {
+            atomic_fetch_add(&future->refCount, 1);
+            mtx_unlock(&resolver.mutex);
+            fprintf(stderr, "DNS Lookup In Progress: %s\n", hi_str(host));
+            return future;
+        }
+    }
+    //A lookup for this host may have finished since we checked the cache above
+    future = future_from_cache(host);
+    if (future != nullptr)
+    {
+        mtx_unlock(&resolver.mutex);
+        return future;
+    }
+    fprintf(stderr, "DNS Cache Miss: %s\n", hi_str(host));
+    future = dns_future_new(host, DNS_FUTURE_PENDING, 2); //One reference for the caller, one for the job
+    future->nextInFlight = resolver.inFlight;
+    resolver.inFlight = future;
+    mtx_unlock(&resolver.mutex);
+
+    tp_submit(resolver.pool, resolve_job, future);
+    return future;
+}
+
+void resolve_prefetch(const char *host)
+{
+    dns_future_release(resolve_async(host));
+}
+
+void resolve_prefetch_id(hostId host)
+{
+    dns_future_release(resolve_async_id(host));
+}
+
+void dns_future_on_ready(dnsFuture *future, dnsCallback callback, void *userData)
+{
+    mtx_lock(&resolver.mutex);
+    if (future->state == DNS_FUTURE_PENDING)
+    {
+        struct dnsWaiter *waiter = calloc(1, sizeof(struct dnsWaiter));
+        *waiter = (struct dnsWaiter) { .callback = callback, .userData = userData, .next = future->waiters };
+        future->waiters = waiter;
+        mtx_unlock(&resolver.mutex);
+        return;
+    }
+    mtx_unlock(&resolver.mutex);
+    callback(future, userData);
+}
+
+bool dns_future_wait(dnsFuture *future, addrList *output)
+{
+    mtx_lock(&resolver.mutex);
+    while (future->state == DNS_FUTURE_PENDING) cnd_wait(&resolver.finished, &resolver.mutex);
+    mtx_unlock(&resolver.mutex);
+    return dns_future_result(future, output);
+}
+
+bool dns_future_result(dnsFuture *future, addrList *output)
+{
+    mtx_lock(&resolver.mutex);
+    bool resolved = future->state == DNS_FUTURE_RESOLVED;
+    if (resolved) *output = future->addrs;
+    mtx_unlock(&resolver.mutex);
+    return resolved;
+}
+
+resolvedAddr addr_list_pick(const addrList *addrs, int port)
+{
+    //Prefer whichever family we last connected over, otherwise IPv4 since that's what we have always connected over
+    int family = addrs->preferredFamily != AF_UNSPEC ? addrs->preferredFamily : AF_INET;
+    size_t chosen = 0;
+    for (size_t i = 0; i < addrs->count; i++)
+    {
+        if (addrs->addrs[i].addr.ss_family == family)
+        {
+            chosen = i;
+            break;
+        }
+    }
+    resolvedAddr output = addrs->addrs[chosen];
+    resolved_addr_set_port(&output, port);
+    return output;
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,77 @@
+/*
+*  This Source Code Form is subject to the terms of the Mozilla Public
+*  License, v. 2.0. If a copy of the MPL was not distributed with this
+*  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#ifndef GOPHERBROWSER_RESOLVER_H
+#define GOPHERBROWSER_RESOLVER_H
+
+#include <stdbool.h>
+#include "addr-cache.h"
+
+//Number of threads blocked in getaddrinfo at most at any one time
+#define RESOLVER_DEFAULT_THREADS 4
+
+/*
+ Handle to the eventual result of a hostname lookup.
+ Should be created with resolve_async and released with dns_future_release.
+ */
+typedef struct dnsFuture dnsFuture;
+
+/*
+ Called once the lookup behind a future has finished.
+ Runs on the resolver thread that did the lookup, or on the caller's thread if the result was already available.
+ */
+typedef void (*dnsCallback)(dnsFuture *future, void *userData);
+
+/*
+ Starts looking up the specified host and returns immediately.
+ Answers from the DNS cache produce a future that is already complete,
+ and a host that is already being looked up shares the lookup in progress rather than starting another.
+ */
+dnsFuture *resolve_async(const char *host);
+
+/*
+ Same as resolve_async, for a host that has already been interned.
+ */
+dnsFuture *resolve_async_id(hostId host);
+
+/*
+ Starts looking up the specified host without keeping a handle to the result,
+ so that it is in the DNS cache by the time it is needed.
+ */
+void resolve_prefetch(const char *host);
+
+/*
+ Same as resolve_prefetch, for a host that has already been interned.
+ */
+void resolve_prefetch_id(hostId host);
+
+/*
+ Arranges for callback to be called when the lookup finishes, or immediately if it already has.
+ Each future supports any number of callbacks.
+ */
+void dns_future_on_ready(dnsFuture *future, dnsCallback callback, void *userData);
+
+/*
+ Blocks until the lookup finishes. Returns true and fills in output if the host resolved.
+ */
+bool dns_future_wait(dnsFuture *future, addrList *output);
+
+/*
+ Gets the result of a lookup that has already finished. Returns true and fills in output if the host resolved.
+ */
+bool dns_future_result(dnsFuture *future, addrList *output);
+
+/*
+ Releases the caller's reference to the future.
+ */
+void dns_future_release(dnsFuture *future);
+
+/*
+ Picks the address to connect to out of a lookup result and sets its port.
+ */
+resolvedAddr addr_list_pick(const addrList *addrs, int port);
+
+#endif //GOPHERBROWSER_RESOLVER_H
\ No newline at end of file
@@ -9,48 +9,56 @@
 #include <stdlib.h>
 #include "string_utils.h"
 
-void sb_set_contents(stringBuilder *sb, const char *contents)
+void sb_reserve(stringBuilder *sb, size_t numChars)
 {
-    if (STR_REQUIRED_BYTES(contents) > sb->capacity)
+    if (sb->length + numChars < sb->capacity) return;
+    //Growing geometrically keeps repeated appends from copying the whole string every time
+    size_t newCapacity = sb->capacity * 2;
+    if (newCapacity < sb->length + numChars + 1) newCapacity = sb->length + numChars + 1;
+    if (newCapacity < SB_DEFAULT_SIZE) newCapacity = SB_DEFAULT_SIZE;
+    if (sb->capacity == 0) //Either SB_EMPTY or freed, so the contents aren't ours to realloc
     {
-        free(sb->contents);
-        sb->contents = calloc(STR_REQUIRED_BYTES(contents), 1);
+        char *newBuffer = malloc(newCapacity);
+        memcpy(newBuffer, sb->contents, sb->length + 1);
+        sb->contents = newBuffer;
     }
-    strcpy(sb->contents, contents);
+    else sb->contents = realloc(sb->contents, newCapacity);
+    sb->capacity = newCapacity;
+}
+
+void sb_set_contents(stringBuilder *sb, const char *contents)
+{
+    sb->length = 0;
+    if (sb->capacity != 0) sb->contents[0] = '\0';
+    sb_append_contents(sb, contents);
+}
+
+void sb_append_n(stringBuilder *sb, const char *contents, size_t length)
+{
+    sb_reserve(sb, length);
+    memcpy(sb->contents + sb->length, contents, length);
+    sb->length += length;
+    sb->contents[sb->length] = '\0';
 }
 
 void sb_append_contents(stringBuilder *sb, const char *contents)
 {
-    if (STR_CONCAT_REQUIRED_BYTES(sb->contents, contents) > sb->capacity)
-    {
-        char *newBuffer = calloc(STR_CONCAT_REQUIRED_BYTES(sb->contents, contents), 1);
-        sb->capacity = STR_CONCAT_REQUIRED_BYTES(sb->contents, contents);
-        strcpy(newBuffer, sb->contents);
-        free(sb->contents);
-        sb->contents = newBuffer;
-    }
-    strcpy(sb->contents + strlen(sb->contents), contents);
+    sb_append_n(sb, contents, strlen(contents));
 }
 
 void sb_append_char(stringBuilder *sb, char c)
 {
-    if (STR_REQUIRED_BYTES(sb->contents) + sizeof(char) > sb->capacity)
-    {
-        char *newBuffer = calloc(STR_REQUIRED_BYTES(sb->contents) + sizeof(char), 1);
-        sb->capacity = STR_REQUIRED_BYTES(sb->contents) + sizeof(char);
-        strcpy(newBuffer, sb->contents);
-        free(sb->contents);
-        sb->contents = newBuffer;
-    }
-    size_t position = sb_len(*sb);
-    sb->contents[position] = c;
-    sb->contents[position + 1] = '\0';
+    if (sb->length + 1 >= sb->capacity) sb_reserve(sb, 1);
+    sb->contents[sb->length++] = c;
+    sb->contents[sb->length] = '\0';
 }
 
 stringBuilder sb_new(size_t initialCapacity)
 {
+    if (initialCapacity == 0) return SB_EMPTY; //Nothing to allocate yet; the first append will
     stringBuilder sb;
     sb.capacity = initialCapacity;
+    sb.length = 0;
     sb.contents = calloc(initialCapacity, sizeof(char));
     return sb;
 }
@@ -58,9 +66,10 @@ stringBuilder sb_new(size_t initialCapacity)
 stringBuilder sb_new_with_contents(const char *contents)
 {
     stringBuilder sb;
-    sb.capacity = STR_REQUIRED_BYTES(contents);
-    sb.contents = calloc(sb.capacity, 1);
-    strcpy(sb.contents, contents);
+    sb.length = strlen(contents);
+    sb.capacity = sb.length + 1;
+    sb.contents = malloc(sb.capacity);
+    memcpy(sb.contents, contents, sb.capacity);
     return sb;
 }
 
@@ -68,6 +77,7 @@ void sb_free(stringBuilder *sb)
 {
     if (sb->capacity == 0) return; //The capacity should equal zero if and only if it has already been freed
     sb->capacity = 0;
+    sb->length = 0;
     free(sb->contents);
     sb->contents = ""; //This should prevent a segfault if for some reason we try to read the contents later-- it will just show up as nothing instead
 }
@@ -75,21 +85,7 @@ void sb_free(stringBuilder *sb)
 stringBuilder substr(const char *str, size_t start, size_t len)
 {
     stringBuilder output = sb_new(len + 1);
-
-#ifdef alloca   //alloca is not a standard C feature, so we fall back to one that is if we don't have it
-                //If we do, though, it's preferable to use that because it's faster and is freed as soon as the function returns
-    char *sub = alloca((len + 1) * sizeof(char));
-#else
-    char *sub = calloc(len + 1, sizeof(char));
-#endif
-
-    strncpy(sub, str + start, len);
-    sb_set_contents(&output, sub);
-
-#ifndef alloca
-    free(sub);
-#endif
-
+    sb_append_n(&output, str + start, strnlen(str + start, len)); //Stops early at a null terminator, like strncpy
     return output;
 }
 
@@ -162,23 +158,35 @@ void trim(char *s)
     trim_end(s);
 }
 
+static_assert(sizeof(stringView) == sizeof(const char *) + 2 * sizeof(size_t), "stringView should be three words");
+static_assert(offsetof(stringView, outOfLine.inlineLength) == offsetof(stringView, inlined.inlineLength),
+              "Both halves of stringView should keep inlineLength in the same byte");
+
 stringView sv_new(const char *contents)
 {
-    if (strlen(contents) == 0) return (stringView) { .length = 0, .contents = "" };
-    size_t bufferSize = STR_REQUIRED_BYTES(contents);
-    char *contentBuf = calloc(bufferSize + 256, 1);
-    memcpy(contentBuf, contents, bufferSize);
-    return (stringView) { .length = bufferSize - 1, .contents = contentBuf };
+    return sv_new_n(contents, strlen(contents));
 }
 
-void sv_free(stringView *sv)
+stringView sv_new_n(const char *contents, size_t length)
 {
-    if (sv->length == 0) return;
-    free((void*)sv->contents);
-    sv->length = 0;
-    sv->contents = "";
+    stringView output = SV_EMPTY;
+    if (length <= SV_INLINE_CAPACITY)
+    {
+        memcpy(output.inlined.contents, contents, length);
+        output.inlined.contents[length] = '\0';
+        output.inlined.inlineLength = length;
+        return output;
+    }
+    char *contentBuf = calloc(length + 1 + 256, 1);
+    memcpy(contentBuf, contents, length);
+    return sv_borrow(contentBuf, length);
 }
 
+void sv_free(stringView *sv)
+{
+    if (!sv_is_inline(*sv) && sv->outOfLine.length != 0) free((void*)sv->outOfLine.contents);
+    *sv = SV_EMPTY;
+}
 
 //atomicStrList(see string_utils.h for more information)
 #if FALSE
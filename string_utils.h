@@ -20,17 +20,19 @@
 #define STR_CONCAT_REQUIRED_BYTES(str1, str2) ((strlen(str1) + strlen(str2) + 1) * sizeof(char))
 
 /*
- Structure that stores a string and the capacity of the buffer.
- Should be created and modified only with the sb_* functions.
+ Structure that stores a string, its length and the capacity of the buffer.
+ Should be created and modified only with the sb_* functions, so that the length stays in sync with the contents.
+ The buffer at least doubles whenever it has to grow, so appending a character at a time takes amortized constant time.
  NOTE: must be freed with the sb_free function when no longer needed.
  */
 typedef struct stringBuilder
 {
     size_t capacity;
+    size_t length; //Not counting the null terminator
     char *contents;
 } stringBuilder;
 
-#define SB_EMPTY ((stringBuilder) { .capacity = 0, .contents = "" })
+#define SB_EMPTY ((stringBuilder) { .capacity = 0, .length = 0, .contents = "" })
 
 /*
  Sets the contents of the specified stringBuilder to the given string.
@@ -42,6 +44,12 @@ void sb_set_contents(stringBuilder *sb, const char *contents);
  */
 void sb_append_contents(stringBuilder *sb, const char *contents);
 
+/*
+ Appends the first length characters of the given string to the stringBuilder.
+ The string doesn't need to be null-terminated.
+ */
+void sb_append_n(stringBuilder *sb, const char *contents, size_t length);
+
 /*
  Appends a single character to the end of the stringBuilder's contents.
  */
@@ -54,6 +62,12 @@ stringBuilder sb_new(size_t initialCapacity);
 
 #define sb_new_with_default_size() sb_new(SB_DEFAULT_SIZE)
 
+/*
+ Makes sure the stringBuilder has room for at least numChars more characters, plus the null terminator,
+ so that appending them won't have to allocate.
+ */
+void sb_reserve(stringBuilder *sb, size_t numChars);
+
 /*
  Allocates a new stringBuilder with the specified contents.
  */
@@ -74,25 +88,70 @@ void sb_free(stringBuilder *sb);
 
 /*
  Gets the length of the string in the stringBuilder.
- (Wrapper around strlen for stringBuilder)
  */
-#define sb_len(_sb) strlen((_sb).contents)
+#define sb_len(_sb) ((_sb).length)
 //size_t sb_len(stringBuilder sb);
 
+//Longest string a stringView keeps inside itself rather than on the heap: 22 bytes on 64-bit targets
+#define SV_INLINE_CAPACITY (sizeof(const char *) + 2 * sizeof(size_t) - 2)
+//inlineLength of a stringView whose contents are somewhere else
+#define SV_NOT_INLINE 0xFF
+
 /*
- Immutable heap-allocated string that stores its length.
+ Immutable string that stores its length.
+ Strings of up to SV_INLINE_CAPACITY bytes are kept inside the stringView itself, and longer ones on the heap,
+ or in memory owned by something else for a view made with sv_borrow.
+ Read it with sv_str and sv_len, which work for both; the contents are always null-terminated.
+ Since inline contents move with the stringView, a pointer from sv_str is only good as long as the stringView it came from.
+ A zeroed stringView is a valid empty one.
  */
-typedef struct stringView
+typedef union stringView
 {
-    size_t length;
-    const char *contents;
+    struct
+    {
+        const char *contents;
+        size_t length;
+        unsigned char padding[sizeof(size_t) - 1];
+        unsigned char inlineLength; //Always SV_NOT_INLINE
+    } outOfLine;
+    struct
+    {
+        char contents[SV_INLINE_CAPACITY + 1];
+        unsigned char inlineLength;
+    } inlined;
 } stringView;
 
+#define SV_EMPTY ((stringView) { .inlined = { .inlineLength = 0 } })
+
+#define sv_is_inline(_sv) ((_sv).inlined.inlineLength != SV_NOT_INLINE)
+
+/*
+ Gets the contents of the stringView as a null-terminated string.
+ */
+#define sv_str(_sv) (sv_is_inline(_sv) ? (const char *)(_sv).inlined.contents : (_sv).outOfLine.contents)
+
+/*
+ Gets the length of the string in the stringView.
+ */
+#define sv_len(_sv) (sv_is_inline(_sv) ? (size_t)(_sv).inlined.inlineLength : (_sv).outOfLine.length)
+
+/*
+ Makes a stringView of length bytes of someone else's memory, which must be followed by a null terminator
+ and outlive the view. Nothing is copied, and the view must not be passed to sv_free.
+ */
+#define sv_borrow(_contents, _length) \
+    ((stringView) { .outOfLine = { .contents = (_contents), .length = (_length), .inlineLength = SV_NOT_INLINE } })
+
 /*
  Creates a new stringView with the specified contents.
  */
 stringView sv_new(const char *contents);
 
+/*
+ Creates a new stringView from the first length characters of the given string, which doesn't need to be null-terminated.
+ */
+stringView sv_new_n(const char *contents, size_t length);
+
 /*
  Frees the memory associated with the specified stringView.
  */
@@ -101,7 +160,7 @@ void sv_free(stringView *sv);
 /*
  Creates a new stringView from the specified stringBuilder's contents.
  */
-#define sv_new_from_sb(_sb) sv_new((_sb).contents)
+#define sv_new_from_sb(_sb) sv_new_n((_sb).contents, sb_len(_sb))
 
 /*
  Copies len characters from the string into the output stringBuilder.
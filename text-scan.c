@@ -0,0 +1,92 @@
+/*
+*  This Source Code Form is subject to the terms of the Mozilla Public
+*  License, v. 2.0. If a copy of the MPL was not distributed with this
+*  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#include "text-scan.h"
+#include <stdbool.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define TS_VECTOR_SIZE 32
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define TS_VECTOR_SIZE 16
+#endif
+
+static inline bool is_delimiter(char c)
+{
+    return c == '\t' || c == '\r' || c == '\n';
+}
+
+static size_t find_delimiter_scalar(const char *text, size_t length)
+{
+    size_t i = 0;
+    while (i < length && !is_delimiter(text[i])) i++;
+    return i;
+}
+
+#if defined(__AVX2__)
+
+size_t ts_find_delimiter(const char *text, size_t length)
+{
+    const __m256i tabs = _mm256_set1_epi8('\t');
+    const __m256i returns = _mm256_set1_epi8('\r');
+    const __m256i newlines = _mm256_set1_epi8('\n');
+    size_t i = 0;
+    for (; i + TS_VECTOR_SIZE <= length; i += TS_VECTOR_SIZE)
+    {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)(text + i));
+        __m256i matches = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, tabs), _mm256_cmpeq_epi8(chunk, returns)),
+                                          _mm256_cmpeq_epi8(chunk, newlines));
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(matches);
+        if (mask != 0) return i + __builtin_ctz(mask);
+    }
+    //Whatever is left is shorter than a vector, and reading past the end isn't safe
+    return i + find_delimiter_scalar(text + i, length - i);
+}
+
+const char *ts_implementation()
+{
+    return "AVX2";
+}
+
+#elif defined(__SSE2__)
+
+size_t ts_find_delimiter(const char *text, size_t length)
+{
+    const __m128i tabs = _mm_set1_epi8('\t');
+    const __m128i returns = _mm_set1_epi8('\r');
+    const __m128i newlines = _mm_set1_epi8('\n');
+    size_t i = 0;
+    for (; i + TS_VECTOR_SIZE <= length; i += TS_VECTOR_SIZE)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(text + i));
+        __m128i matches = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, tabs), _mm_cmpeq_epi8(chunk, returns)),
+                                       _mm_cmpeq_epi8(chunk, newlines));
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(matches);
+        if (mask != 0) return i + __builtin_ctz(mask);
+    }
+    //Whatever is left is shorter than a vector, and reading past the end isn't safe
+    return i + find_delimiter_scalar(text + i, length - i);
+}
+
+const char *ts_implementation()
+{
+    return "SSE2";
+}
+
+#else
+
+size_t ts_find_delimiter(const char *text, size_t length)
+{
+    return find_delimiter_scalar(text, length);
+}
+
+const char *ts_implementation()
+{
+    return "scalar";
+}
+
+#endif
\ No newline at end of file
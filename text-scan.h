@@ -0,0 +1,25 @@
+/*
+*  This Source Code Form is subject to the terms of the Mozilla Public
+*  License, v. 2.0. If a copy of the MPL was not distributed with this
+*  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#ifndef GOPHERBROWSER_TEXT_SCAN_H
+#define GOPHERBROWSER_TEXT_SCAN_H
+
+#include <stddef.h>
+
+/*
+ Finds the first tab, carriage return or line feed in the first length bytes of text,
+ i.e. the end of the current field of a Gopher menu line.
+ Returns length if there isn't one. text doesn't need to be null-terminated.
+ Uses AVX2 when built with it enabled, SSE2 otherwise, and plain C on other architectures.
+ */
+size_t ts_find_delimiter(const char *text, size_t length);
+
+/*
+ Gets the name of the implementation ts_find_delimiter was built with("AVX2", "SSE2" or "scalar").
+ */
+const char *ts_implementation();
+
+#endif //GOPHERBROWSER_TEXT_SCAN_H
\ No newline at end of file
@@ -0,0 +1,89 @@
+/*
+*  This Source Code Form is subject to the terms of the Mozilla Public
+*  License, v. 2.0. If a copy of the MPL was not distributed with this
+*  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#include "thread-pool.h"
+#include "collections.h"
+#include <stdlib.h>
+#include <stdbool.h>
+#include <threads.h>
+
+struct threadPoolTask
+{
+    threadPoolJob job;
+    void *arg;
+};
+
+//Queued tasks are stored by value, so submitting one doesn't allocate unless the queue has to grow
+CREATE_RING_BUFFER_TYPE(taskQueue, tq, struct threadPoolTask)
+
+struct threadPool
+{
+    mtx_t mutex;
+    cnd_t workAvailable;
+    bool stopping;
+    size_t numThreads;
+    thrd_t *threads;
+    taskQueue queue;
+};
+
+static int tp_worker_main(void *arg)
+{
+    threadPool *pool = arg;
+    while (true)
+    {
+        mtx_lock(&pool->mutex);
+        while (pool->queue.count == 0 && !pool->stopping) cnd_wait(&pool->workAvailable, &pool->mutex);
+        struct threadPoolTask task;
+        if (!tq_pop(&pool->queue, &task)) //Only possible once we're stopping and the queue has drained
+        {
+            mtx_unlock(&pool->mutex);
+            return 0;
+        }
+        mtx_unlock(&pool->mutex);
+
+        task.job(task.arg);
+    }
+}
+
+threadPool *tp_new(size_t numThreads)
+{
+    threadPool *pool = calloc(1, sizeof(threadPool));
+    mtx_init(&pool->mutex, mtx_plain);
+    cnd_init(&pool->workAvailable);
+    pool->numThreads = numThreads > 0 ? numThreads : 1;
+    pool->queue = tq_new(pool->numThreads * 2);
+    pool->threads = calloc(pool->numThreads, sizeof(thrd_t));
+    for (size_t i = 0; i < pool->numThreads; i++)
+    {
+        thrd_create(&pool->threads[i], tp_worker_main, pool);
+    }
+    return pool;
+}
+
+void tp_submit(threadPool *pool, threadPoolJob job, void *arg)
+{
+    mtx_lock(&pool->mutex);
+    tq_push(&pool->queue, (struct threadPoolTask) { .job = job, .arg = arg });
+    cnd_signal(&pool->workAvailable);
+    mtx_unlock(&pool->mutex);
+}
+
+void tp_free(threadPool *pool)
+{
+    mtx_lock(&pool->mutex);
+    pool->stopping = true;
+    cnd_broadcast(&pool->workAvailable);
+    mtx_unlock(&pool->mutex);
+    for (size_t i = 0; i < pool->numThreads; i++)
+    {
+        thrd_join(pool->threads[i], nullptr);
+    }
+    free(pool->threads);
+    tq_free(&pool->queue);
+    cnd_destroy(&pool->workAvailable);
+    mtx_destroy(&pool->mutex);
+    free(pool);
+}
\ No newline at end of file
@@ -0,0 +1,35 @@
+/*
+*  This Source Code Form is subject to the terms of the Mozilla Public
+*  License, v. 2.0. If a copy of the MPL was not distributed with this
+*  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#ifndef GOPHERBROWSER_THREAD_POOL_H
+#define GOPHERBROWSER_THREAD_POOL_H
+
+#include <stddef.h>
+
+typedef void (*threadPoolJob)(void *arg);
+
+/*
+ Fixed-size pool of worker threads that run jobs in the order they were submitted.
+ Should be created with tp_new and destroyed with tp_free.
+ */
+typedef struct threadPool threadPool;
+
+/*
+ Starts a pool with the specified number of worker threads.
+ */
+threadPool *tp_new(size_t numThreads);
+
+/*
+ Queues a job to be run on one of the pool's threads.
+ */
+void tp_submit(threadPool *pool, threadPoolJob job, void *arg);
+
+/*
+ Runs every job that has already been queued, then stops the workers and frees the pool.
+ */
+void tp_free(threadPool *pool);
+
+#endif //GOPHERBROWSER_THREAD_POOL_H
\ No newline at end of file
@@ -6,7 +6,9 @@
 
 #include "ui.h"
 #include "buffer-utils.h"
+#include "buffer-pool.h"
 #include "gopher-protocol.h"
+#include "compact-menu.h"
 #include "network-interface.h"
 #include "string_utils.h"
 #include <gtk/gtk.h>
@@ -26,8 +28,68 @@
 
 static GtkWidget *window, *pageBox, *pageEntry, *scrollView;
 static gopherMenu currentPage = { 0 };
-static atomic_bool pageIsLoading = false;
-static temporaryMem pageTempMem = { 0 };
+static GMutex pageLoadMutex; //Held for the whole of a page load, so only one runs at a time
+//Cancels the page load in progress, or once it has finished, the image prefetches of the page it loaded.
+//It's only replaced and cancelled by the next navigation, so a page's prefetches never hold up leaving it.
+static _Atomic(fetchCancelToken *) pageCancelToken = nullptr;
+//Everything allocated for a page comes out of its arena, which is only touched with pageLoadMutex held.
+//pageArena belongs to the newest page; the other one to the page before it, which may still be on screen
+//until show_page has run, so it's only reset by the load after that.
+static memArena pageArenas[2] = { MA_EMPTY, MA_EMPTY };
+static memArena *pageArena = &pageArenas[0];
+static GMutex pageShownMutex;
+static GCond pageShownCond;
+static bool pageShowPending = false; //A finished page is waiting for the main loop to put it on screen
+static GtkWidget **pageImageHolders = nullptr; //Per entity of currentPage; the box each image is shown in once it arrives
+static size_t numPageImageHolders = 0;
+//The page a menu preview was put on screen over, to go back there if the load is cancelled. Only used on the main loop.
+static GtkWidget *pageUnderPreview = nullptr;
+
+//How far outside the visible part of the page an image may be and still count as visible
+#define IMAGE_VISIBILITY_MARGIN 200
+
+//How many lines of a menu are shown while the rest of it is still arriving
+#define MENU_PREVIEW_ENTITIES 100
+
+//Menus at least this big are kept as a compactMenu once they're parsed, rather than holding onto the response
+//and a gopherEntity for every line, most of which are only ever looked at to be drawn
+#define COMPACT_MENU_BYTES (256 * 1024)
+
+/*
+ The top of a menu that is still loading. It's shown as soon as the first line arrives,
+ and replaced by the real page once the whole response is in.
+ */
+struct menuPreview
+{
+    GtkWidget *box;
+    gopherMenuParser parser;
+    fetchCancelToken *cancelToken; //The load's
+};
+
+struct previewLine
+{
+    GtkWidget *box;
+    char *text;
+    bool first;
+    fetchCancelToken *cancelToken;
+};
+
+struct prefetchedImage
+{
+    GtkWidget *holder;
+    sharedBuffer *data;
+    char *selector;
+};
+
+//What a link on a compactMenu page holds onto, in place of a gopherEntity of its own
+struct compactLink
+{
+    const compactMenu *menu;
+    size_t index;
+};
+
+static gopherMenu render_compact_menu(GtkBox *box, resizableBuffer *source, const compactMenu **compactOutput);
+static void render_entity(GtkBox *box, gopherEntity *entity, const compactMenu *compact, size_t index);
 
 bool update_ui(GtkBox *box)
 {
@@ -37,13 +99,28 @@ bool update_ui(GtkBox *box)
     return false;
 }
 
-bool set_page_entry_text(stringBuilder *text)
+//Puts a finished page on screen, after which the page it replaced is no longer in use
+static bool show_page(GtkBox *box)
+{
+    update_ui(box);
+    if (pageUnderPreview != nullptr)
+    {
+        g_object_unref(pageUnderPreview);
+        pageUnderPreview = nullptr;
+    }
+    g_mutex_lock(&pageShownMutex);
+    pageShowPending = false;
+    g_cond_signal(&pageShownCond);
+    g_mutex_unlock(&pageShownMutex);
+    return false;
+}
+
+bool set_page_entry_text(const char *text)
 {
     GtkEntryBuffer *buffer = gtk_entry_get_buffer(GTK_ENTRY(pageEntry));
     gtk_entry_buffer_delete_text(buffer, 0, (int)gtk_entry_buffer_get_length(buffer));
-    gb_gtk_ext_entry_buffer_append_text(buffer, text->contents);
+    gb_gtk_ext_entry_buffer_append_text(buffer, text);
     //gtk_entry_buffer_set_text(gtk_entry_get_buffer(GTK_ENTRY(pageEntry)), text->contents, (int)sb_len(*text));
-    sb_free(text);
     return false;
 }
 
@@ -87,21 +164,223 @@ void display_gopher_page(resizableBuffer *buf, gopherEntityType type)
 
 }
 
+static void end_page_load(fetchCancelToken *cancelToken)
+{
+    //pageCancelToken keeps its own reference, since the page's prefetches go on using the token after the load is over
+    fe_cancel_token_release(cancelToken);
+    g_mutex_unlock(&pageLoadMutex);
+}
+
+static void append_image_to_gtk(GtkBox *box, resizableBuffer imageBuf, const char *selector)
+{
+    PangoAttrList *fontAttrs = pango_attr_list_new();
+    pango_attr_list_insert(fontAttrs, pango_attr_font_desc_new(pango_font_description_from_string("monospace 16")));
+    if (imageBuf.count == 0)
+    {
+        GtkWidget *label = gtk_label_new("Image failed to load.");
+        gtk_label_set_attributes(GTK_LABEL(label), fontAttrs);
+        gtk_box_append(box, label);
+        return;
+    }
+    /*FILE *rawImg = fopen("rawimage.bin", "wb");
+    fwrite(imageBuf.contents, 1, imageBuf.count, rawImg);
+    fclose(rawImg);*/
+
+    //GdkTexture *texture = gdk_memory_texture_new(x, y, GDK_MEMORY_R8G8B8A8, (GBytes *) image, x * 4);
+    GError *error = nullptr;
+    GBytes *imgBytes = g_bytes_new(imageBuf.contents, imageBuf.count);
+    GdkTexture *texture = gdk_texture_new_from_bytes(imgBytes, &error);
+    if (error != nullptr)
+    {
+        fprintf(stderr, "A GDK error occurred when loading %s: %s", selector, error->message);
+        GtkWidget *label = gtk_label_new("Image failed to load.");
+        gtk_label_set_attributes(GTK_LABEL(label), fontAttrs);
+        gtk_box_append(box, label);
+        return;
+    }
+    GtkWidget *picture = gtk_picture_new();
+    gtk_picture_set_paintable(GTK_PICTURE(picture), GDK_PAINTABLE(texture));
+    gtk_picture_set_content_fit(GTK_PICTURE(picture), GTK_CONTENT_FIT_CONTAIN);
+    SET_MARGINS(picture, 10, 10, 0, 10);
+    gtk_widget_set_halign(picture, GTK_ALIGN_START);
+    gtk_box_append(box, picture);
+}
+
+static bool show_prefetched_image(struct prefetchedImage *image)
+{
+    append_image_to_gtk(GTK_BOX(image->holder), image->data != nullptr ? image->data->buffer : RB_EMPTY, image->selector);
+    srb_release(image->data);
+    g_object_unref(image->holder);
+    free(image->selector);
+    free(image);
+    return false;
+}
+
+//Runs on the fetch engine's thread, so the widget work is handed to the main loop
+static void on_image_prefetched(gopherEntity *entity, size_t entityIndex, void *userData)
+{
+    GtkWidget **holders = userData;
+    struct prefetchedImage *image = malloc(sizeof(struct prefetchedImage));
+    image->holder = g_object_ref(holders[entityIndex]);
+    image->data = entity->prefetchedData != nullptr ? srb_ref(entity->prefetchedData) : nullptr;
+    image->selector = strdup(sv_str(entity->selector));
+    g_idle_add(G_SOURCE_FUNC(show_prefetched_image), image);
+}
+
+static void free_page_image_holders()
+{
+    for (size_t i = 0; i < numPageImageHolders; i++)
+    {
+        if (pageImageHolders[i] != nullptr) g_object_unref(pageImageHolders[i]);
+    }
+    pageImageHolders = nullptr; //The array itself belongs to the page's arena
+    numPageImageHolders = 0;
+}
+
+//Images that have scrolled into view jump ahead of the rest of the page's prefetches, and ones scrolled past fall back
+static void on_page_scrolled(GtkAdjustment *adjustment, gpointer)
+{
+    //A page load in progress owns currentPage; it'll be scrolled again soon enough
+    if (!g_mutex_trylock(&pageLoadMutex)) return;
+    double viewHeight = gtk_adjustment_get_page_size(adjustment);
+    for (size_t i = 0; i < numPageImageHolders; i++)
+    {
+        GtkWidget *holder = pageImageHolders[i];
+        //Already showing something, so there's nothing left to prioritize
+        if (holder == nullptr || gtk_widget_get_first_child(holder) != nullptr) continue;
+        graphene_point_t origin = GRAPHENE_POINT_INIT_ZERO, position;
+        if (!gtk_widget_compute_point(holder, scrollView, &origin, &position)) continue;
+        bool visible = position.y + gtk_widget_get_height(holder) >= -IMAGE_VISIBILITY_MARGIN
+                && position.y <= viewHeight + IMAGE_VISIBILITY_MARGIN;
+        gopher_menu_prefetch_set_priority(&currentPage, i, visible ? FETCH_PRIORITY_VISIBLE : FETCH_PRIORITY_SPECULATIVE);
+    }
+    g_mutex_unlock(&pageLoadMutex);
+}
+
+static void free_preview_line(struct previewLine *line)
+{
+    g_object_unref(line->box);
+    fe_cancel_token_release(line->cancelToken);
+    free(line->text);
+    free(line);
+}
+
+static bool append_preview_line(struct previewLine *line)
+{
+    //Lines still queued when their load was cancelled would cover up whatever is on screen now
+    if (fe_is_cancelled(line->cancelToken))
+    {
+        free_preview_line(line);
+        return false;
+    }
+    if (line->first)
+    {
+        GtkWidget *shown = gtk_scrolled_window_get_child(GTK_SCROLLED_WINDOW(scrollView));
+        pageUnderPreview = shown != nullptr ? g_object_ref(shown) : nullptr;
+        update_ui(GTK_BOX(line->box));
+    }
+    PangoAttrList *fontAttrs = pango_attr_list_new();
+    pango_attr_list_insert(fontAttrs, pango_attr_font_desc_new(pango_font_description_from_string("monospace 16")));
+    GtkWidget *label = gtk_label_new(line->text);
+    gtk_label_set_attributes(GTK_LABEL(label), fontAttrs);
+    gtk_widget_add_css_class(label, "dim-label"); //Links don't work until the real page replaces this
+    SET_DEFAULT_ALIGNMENT(label);
+    SET_MARGINS(label, 10, 10, 0, 10);
+    gtk_box_append(GTK_BOX(line->box), label);
+    free_preview_line(line);
+    return false;
+}
+
+//Puts the page a cancelled load's preview replaced back on screen
+static bool restore_page_under_preview(void *)
+{
+    if (pageUnderPreview == nullptr) return false;
+    update_ui(GTK_BOX(pageUnderPreview));
+    g_object_unref(pageUnderPreview);
+    pageUnderPreview = nullptr;
+    return false;
+}
+
+//Runs on the fetch engine's thread, so the widget work is handed to the main loop
+static void on_preview_entity(gopherEntity *entity, void *userData)
+{
+    struct menuPreview *preview = userData;
+    if (preview->parser.numEntities > MENU_PREVIEW_ENTITIES) return;
+    struct previewLine *line = malloc(sizeof(struct previewLine));
+    line->box = g_object_ref(preview->box);
+    line->text = strdup(sv_str(entity->displayName));
+    line->first = preview->parser.numEntities == 1;
+    line->cancelToken = fe_cancel_token_ref(preview->cancelToken);
+    g_idle_add(G_SOURCE_FUNC(append_preview_line), line);
+}
+
+static void on_menu_chunk(const char *data, size_t length, void *userData)
+{
+    struct menuPreview *preview = userData;
+    //Past the first screen, there's nothing to gain over waiting for the real page
+    if (preview->parser.numEntities < MENU_PREVIEW_ENTITIES) gopher_menu_parser_feed(&preview->parser, data, length);
+}
+
 void *load_page_ex(const char *host, const char *selector, int port, gopherEntityType type)
 {
-    if (pageIsLoading) return nullptr;
-    pageIsLoading = true;
+    //Navigating away abandons the page that is still loading, or the images the last page is still fetching,
+    //so they finish and free their sockets and buffers right away rather than holding up gopher_menu_free below
+    fetchCancelToken *cancelToken = fe_cancel_token_new();
+    fetchCancelToken *previousToken = atomic_exchange(&pageCancelToken, fe_cancel_token_ref(cancelToken));
+    if (previousToken != nullptr)
+    {
+        fe_cancel(previousToken);
+        fe_cancel_token_release(previousToken);
+    }
+    g_mutex_lock(&pageLoadMutex);
+    if (fe_is_cancelled(cancelToken)) //Something else was clicked while we were waiting for the previous load
+    {
+        end_page_load(cancelToken);
+        return nullptr;
+    }
+    fetchOptions pageFetchOptions = FETCH_OPTIONS_DEFAULT;
+    pageFetchOptions.cancelToken = cancelToken;
+
     if (!currentPage.freed) gopher_menu_free(&currentPage);
-    temporaryMem prevTempMem = pageTempMem;
-    pageTempMem = tm_new();
+    free_page_image_holders();
+    //The last page may not have replaced the one before it on screen yet, and that one's arena is about to be reused
+    g_mutex_lock(&pageShownMutex);
+    while (pageShowPending) g_cond_wait(&pageShownCond, &pageShownMutex);
+    g_mutex_unlock(&pageShownMutex);
+    memArena *shownArena = pageArena;
+    pageArena = pageArena == &pageArenas[0] ? &pageArenas[1] : &pageArenas[0];
+    ma_reset(pageArena);
     GtkWidget *output = nullptr;
-    resizableBuffer buf = get_gopher_page_ex(host, selector, port);
-    stringBuilder sb = sb_new(STR_CONCAT_REQUIRED_BYTES(host, selector) + 3);
-    stringBuilder *pageEntryText = tm_add(&pageTempMem, &sb, sizeof(stringBuilder));
-    sb_append_contents(pageEntryText, host);
-    char typeStr[3] = { '/', type, '\0'};
-    sb_append_contents(pageEntryText, typeStr);
-    sb_append_contents(pageEntryText, selector);
+    struct menuPreview preview = { .box = nullptr };
+    if (type == GOPHER_ENTITY_MENU || type == GOPHER_ENTITY_INDEX_SERVER)
+    {
+        //On a slow link, the top of the menu can be on screen long before the end of it has arrived
+        preview.box = g_object_ref_sink(gtk_box_new(GTK_ORIENTATION_VERTICAL, 6));
+        preview.parser = gopher_menu_parser_new(on_preview_entity, &preview);
+        preview.cancelToken = cancelToken;
+        pageFetchOptions.onChunk = on_menu_chunk;
+        pageFetchOptions.chunkUserData = &preview;
+    }
+    resizableBuffer buf = get_gopher_page_with_options(host, selector, port, &pageFetchOptions);
+    //The transaction is over, so nothing else is coming in through the preview
+    if (preview.box != nullptr)
+    {
+        gopher_menu_parser_free(&preview.parser);
+        g_object_unref(preview.box);
+    }
+    if (fe_is_cancelled(cancelToken))
+    {
+        bp_return(&buf);
+        //The last page goes back on screen in place of the preview, if that got as far as being shown, so its arena
+        //is still the one in use. The images it hadn't fetched yet stay empty, since its prefetches are gone.
+        if (preview.box != nullptr) g_idle_add(G_SOURCE_FUNC(restore_page_under_preview), nullptr);
+        pageArena = shownArena;
+        end_page_load(cancelToken);
+        return nullptr;
+    }
+    size_t pageEntryTextSize = STR_CONCAT_REQUIRED_BYTES(host, selector) + 2;
+    char *pageEntryText = ma_alloc(pageArena, pageEntryTextSize, 1);
+    snprintf(pageEntryText, pageEntryTextSize, "%s/%c%s", host, type, selector);
     g_idle_add(G_SOURCE_FUNC(set_page_entry_text), pageEntryText);
     /*GtkEntryBuffer *pageEntryBuffer = gtk_entry_get_buffer(GTK_ENTRY(pageEntry));
     gtk_entry_buffer_delete_text(pageEntryBuffer, 0, (int)gtk_entry_buffer_get_length(pageEntryBuffer));
@@ -120,7 +399,7 @@ void *load_page_ex(const char *host, const char *selector, int port, gopherEntit
         {
             output = gtk_box_new(GTK_ORIENTATION_VERTICAL, 6);
             //gtk_scrolled_window_set_child(GTK_SCROLLED_WINDOW(scrollView), output);
-            stringBuilder text = parse_gopher_textfile(buf.contents, buf.count);
+            stringBuilder text = parse_gopher_textfile_from_buffer(&buf);
             GtkWidget *label = gtk_label_new(text.contents);
             sb_free(&text);
             SET_DEFAULT_ALIGNMENT(label);
@@ -129,7 +408,6 @@ void *load_page_ex(const char *host, const char *selector, int port, gopherEntit
             gtk_label_set_attributes(GTK_LABEL(label), fontAttrs);
             gtk_label_set_selectable(GTK_LABEL(label), true);
             SET_MARGINS(label, 10, 10, 0, 10);
-            rb_free(&buf);
             gtk_box_append(GTK_BOX(output), label);
             break;
         }
@@ -137,16 +415,46 @@ void *load_page_ex(const char *host, const char *selector, int port, gopherEntit
         case GOPHER_ENTITY_MENU:
         {
             output = gtk_box_new(GTK_ORIENTATION_VERTICAL, 6);
-            gopherMenu menu = parse_gopher_menu(buf.contents);
-            rb_free(&buf);
+            const compactMenu *compact = nullptr;
+            gopherMenu menu;
+            //A large menu only keeps a gopherEntity for each of its images, which is all the prefetch needs
+            if (buf.count >= COMPACT_MENU_BYTES) menu = render_compact_menu(GTK_BOX(output), &buf, &compact);
+            else
+            {
+                //The menu keeps the response, so the entities can point into it rather than copying every field
+                menu = parse_gopher_menu_in_arena(&buf, pageArena);
+                pageImageHolders = ma_calloc(pageArena, menu.numEntities, sizeof(GtkWidget *));
+                numPageImageHolders = menu.numEntities;
+                for (size_t j = 0; j < menu.numEntities; j++)
+                {
+                    render_gopher_entity_to_gtk(GTK_BOX(output), menu.entities + j);
+                    //Images haven't been fetched yet, so they render as an empty box to be filled in when they arrive
+                    if (gopher_entity_needs_prefetch(menu.entities[j].type))
+                        pageImageHolders[j] = g_object_ref(gtk_widget_get_last_child(output));
+                }
+            }
 
             pageBox = gtk_box_new(GTK_ORIENTATION_VERTICAL, 6);
             //gtk_scrolled_window_set_child(GTK_SCROLLED_WINDOW(scrollView), output);
-            for (size_t j = 0; j < menu.numEntities; j++)
+            currentPage = menu;
+            //Most clicks stay on the same server, so get the TCP handshake out of the way before the user picks a link
+            hostId pageHost = hi_intern(host);
+            size_t numLinks = compact != nullptr ? compact->numEntities : menu.numEntities;
+            for (size_t j = 0; j < numLinks; j++)
             {
-                render_gopher_entity_to_gtk(GTK_BOX(output), menu.entities + j);
+                gopherEntityType linkType = compact != nullptr ? cm_type(compact, j) : menu.entities[j].type;
+                if (linkType == GOPHER_NS_ENTITY_INFO_MESSAGE || linkType == GOPHER_ENTITY_ERROR
+                    || gopher_entity_needs_prefetch(linkType)) continue;
+                bool sameServer = compact != nullptr ? cm_port(compact, j) == port && cm_host_id(compact, j) == pageHost
+                                                   : menu.entities[j].port == port && menu.entities[j].hostId == pageHost;
+                if (sameServer)
+                {
+                    fe_warm_host(host, port, FE_DEFAULT_WARM_SOCKETS);
+                    break;
+                }
             }
-            currentPage = menu;
+            //The page is shown straight away and the images appear as they come in
+            gopher_menu_prefetch_start(&currentPage, &pageFetchOptions, on_image_prefetched, pageImageHolders);
             break;
         }
         case GOPHER_ENTITY_CSO:
@@ -196,10 +504,13 @@ void *load_page_ex(const char *host, const char *selector, int port, gopherEntit
         case GOPHER_NS_ENTITY_XML:
             break;
     }
-    tm_free(&prevTempMem);
-    pageIsLoading = false;
+    //The page being replaced is freed by the next load, once show_page has taken it off screen
+    g_mutex_lock(&pageShownMutex);
+    pageShowPending = true;
+    g_mutex_unlock(&pageShownMutex);
     //gtk_scrolled_window_set_child(GTK_SCROLLED_WINDOW(scrollView), output);
-    g_idle_add(G_SOURCE_FUNC(update_ui), output);
+    g_idle_add(G_SOURCE_FUNC(show_page), output);
+    end_page_load(cancelToken);
     return nullptr;
 }
 
@@ -211,15 +522,15 @@ struct gopherSearchData
 
 void *load_page_ex_wrapper(gopherEntity *data)
 {
-    stringBuilder selector = sb_new_with_contents(data->selector.contents);
+    stringBuilder selector = sb_new_with_contents(sv_str(data->selector));
     if (data->type == GOPHER_ENTITY_INDEX_SERVER)
     {
         struct gopherSearchData *searchData = (struct gopherSearchData*)data;
         sb_append_char(&selector, '\t');
         sb_append_contents(&selector, gtk_entry_buffer_get_text(gtk_entry_get_buffer(searchData->searchEntry)));
     }
-    const char *host = tm_add(&pageTempMem, (void*)data->host.contents, data->host.length + sizeof(char));
-    void *result = load_page_ex(host, selector.contents, data->port, data->type);
+    //The entity goes away with its page once the load starts, but its host is interned and lives on
+    void *result = load_page_ex(hi_str(data->hostId), selector.contents, data->port, data->type);
     sb_free(&selector);
     return result;
 }
@@ -269,6 +580,8 @@ void activate_ui(GtkApplication *app, gpointer user_data)
     gtk_box_append(GTK_BOX(box), scrollView);
     gtk_box_set_homogeneous(GTK_BOX(box), false);
     gtk_widget_set_vexpand(scrollView, true);
+    g_signal_connect(gtk_scrolled_window_get_vadjustment(GTK_SCROLLED_WINDOW(scrollView)), "value-changed",
+                     G_CALLBACK(on_page_scrolled), nullptr);
     //gtk_scrolled_window_set_child(GTK_SCROLLED_WINDOW(scrollView), grid);
 
     int currentRow = 0;
@@ -351,7 +664,7 @@ void handle_gopher_textfile(void*, gpointer data)
 
 void *download_pthread_wrapper(gopherEntity *entity)
 {
-    download_file(entity->host.contents, entity->selector.contents, entity->port);
+    download_file(sv_str(entity->host), sv_str(entity->selector), entity->port);
     return nullptr;
 }
 
@@ -359,24 +672,24 @@ void handle_gopher_page(void*, gpointer data)
 {
     gopherEntity *entity = data;
     /*stringBuilder *pageEntryText = calloc(1, sizeof(stringBuilder));
-    *pageEntryText = sb_new(STR_CONCAT_REQUIRED_BYTES(entity->host.contents, entity->selector.contents) + 3);
-    sb_append_contents(pageEntryText, entity->host.contents);
+    *pageEntryText = sb_new(STR_CONCAT_REQUIRED_BYTES(sv_str(entity->host), sv_str(entity->selector)) + 3);
+    sb_append_contents(pageEntryText, sv_str(entity->host));
     char typeStr[3] = { '/', entity->type, '\0'};
     sb_append_contents(pageEntryText, typeStr);
-    sb_append_contents(pageEntryText, entity->selector.contents);
+    sb_append_contents(pageEntryText, sv_str(entity->selector));
     g_idle_add(G_SOURCE_FUNC(set_page_entry_text), pageEntryText);*/
     GtkEntryBuffer *pageEntryBuffer = gtk_entry_get_buffer(GTK_ENTRY(pageEntry));
 
     gtk_entry_buffer_delete_text(pageEntryBuffer, 0, (int)gtk_entry_buffer_get_length(pageEntryBuffer));
-    gb_gtk_ext_entry_buffer_append_text(pageEntryBuffer, entity->host.contents);
-    /*stringBuilder selector = sb_new_with_contents(entity->selector.contents);
+    gb_gtk_ext_entry_buffer_append_text(pageEntryBuffer, sv_str(entity->host));
+    /*stringBuilder selector = sb_new_with_contents(sv_str(entity->selector));
     if (entity->type == GOPHER_ENTITY_INDEX_SERVER)
     {
         struct gopherSearchData *searchData = data;
         sb_append_char(&selector, '\t');
         sb_append_contents(&selector, gtk_entry_buffer_get_text(gtk_entry_get_buffer(searchData->searchEntry)));
     }*/
-    gb_gtk_ext_entry_buffer_append_text(pageEntryBuffer, entity->selector.contents);
+    gb_gtk_ext_entry_buffer_append_text(pageEntryBuffer, sv_str(entity->selector));
     /*pthread_t thread;
     pthread_create(&thread, nullptr, (void *(*)(void *)) load_page_ex_wrapper, data);*/
     /*GThread *thread = g_thread_new("pageLoad", (GThreadFunc) load_page_ex_wrapper, data);
@@ -393,6 +706,54 @@ void handle_gopher_bin(void*, gopherEntity *entity)
 }
 
 void render_gopher_entity_to_gtk(GtkBox *box, gopherEntity *entity)
+{
+    render_entity(box, entity, nullptr, 0);
+}
+
+//Links on a compactMenu page only keep their index, and the entity is put back together when one is clicked
+static void *load_compact_link(gopherEntity *entity)
+{
+    void *result = load_page_ex_wrapper(entity);
+    free(entity);
+    return result;
+}
+
+static void *download_compact_link(gopherEntity *entity)
+{
+    void *result = download_pthread_wrapper(entity);
+    free(entity);
+    return result;
+}
+
+static void handle_compact_link(void*, gpointer data)
+{
+    struct compactLink *link = data;
+    gopherEntity *entity = malloc(sizeof(gopherEntity));
+    *entity = cm_get_entity(link->menu, link->index);
+    pthread_t thread;
+    if (entity->type == GOPHER_ENTITY_BINARY_FILE || entity->type == GOPHER_ENTITY_MAC_BINHEX
+        || entity->type == GOPHER_ENTITY_PC_DOS_FILE)
+        pthread_create(&thread, nullptr, (void *(*)(void *)) download_compact_link, entity);
+    else pthread_create(&thread, nullptr, (void *(*)(void *)) load_compact_link, entity);
+}
+
+//Entities from a compactMenu are only views, so their links go through handle_compact_link rather than pointing at them
+static void connect_entity_link(GtkWidget *button, GCallback onClick, gopherEntity *entity, const compactMenu *compact,
+                                size_t index)
+{
+    if (compact == nullptr)
+    {
+        g_signal_connect(button, "clicked", onClick, entity);
+        return;
+    }
+    struct compactLink link = { .menu = compact, .index = index };
+    g_signal_connect(button, "clicked", G_CALLBACK(handle_compact_link), ma_add(pageArena, &link, sizeof(link)));
+}
+
+/*
+ Renders the entity, which is entry index of compact if that isn't nullptr.
+ */
+static void render_entity(GtkBox *box, gopherEntity *entity, const compactMenu *compact, size_t index)
 {
     PangoAttrList *fontAttrs = pango_attr_list_new();
     //pango_attr_list_insert(fontAttrs, pango_attr_size_new(18000));
@@ -401,7 +762,7 @@ void render_gopher_entity_to_gtk(GtkBox *box, gopherEntity *entity)
     {
         case GOPHER_NS_ENTITY_INFO_MESSAGE:
         {
-            GtkWidget *label = gtk_label_new(entity->displayName.contents);
+            GtkWidget *label = gtk_label_new(sv_str(entity->displayName));
             gtk_label_set_attributes(GTK_LABEL(label), fontAttrs);
             //gtk_label_set_selectable(GTK_LABEL(label), true);
             SET_DEFAULT_ALIGNMENT(label);
@@ -412,34 +773,33 @@ void render_gopher_entity_to_gtk(GtkBox *box, gopherEntity *entity)
         case GOPHER_NS_ENTITY_HTML:
         case GOPHER_ENTITY_TEXTFILE:
         {
-            GtkWidget *button = gb_gtk_ext_icon_label_button("text-x-generic", entity->displayName.contents);
+            GtkWidget *button = gb_gtk_ext_icon_label_button("text-x-generic", sv_str(entity->displayName));
             SET_DEFAULT_ALIGNMENT(button);
-            gpointer data = (gpointer)entity;
-            g_signal_connect(button, "clicked", G_CALLBACK(handle_gopher_textfile), data);
+            connect_entity_link(button, G_CALLBACK(handle_gopher_textfile), entity, compact, index);
             gtk_box_append(box, button);
             break;
         }
         case GOPHER_ENTITY_MENU:
         {
-            GtkWidget *button = gb_gtk_ext_icon_label_button("inode-directory", entity->displayName.contents);
+            GtkWidget *button = gb_gtk_ext_icon_label_button("inode-directory", sv_str(entity->displayName));
             SET_DEFAULT_ALIGNMENT(button);
-            g_signal_connect(button, "clicked", G_CALLBACK(handle_gopher_page), entity);
+            connect_entity_link(button, G_CALLBACK(handle_gopher_page), entity, compact, index);
             gtk_box_append(box, button);
             break;
         }
         case GOPHER_ENTITY_CSO:
         {
-            fprintf(stderr, "CSO phone book server unsupported. Use other client.\nServer info: %s:%d%s\n", entity->host.contents, entity->port, entity->selector.contents);
+            fprintf(stderr, "CSO phone book server unsupported. Use other client.\nServer info: %s:%d%s\n", sv_str(entity->host), entity->port, sv_str(entity->selector));
             break;
         }
         case GOPHER_ENTITY_ERROR:
         {
             stringBuilder sb = sb_new_with_contents("A server error has occurred: ");
-            sb_append_contents(&sb, entity->displayName.contents);
+            sb_append_contents(&sb, sv_str(entity->displayName));
             GtkWidget *label = gtk_label_new(sb.contents);
             SET_DEFAULT_ALIGNMENT(label);
             sb_free(&sb);
-            fprintf(stderr, "%s\n", entity->displayName.contents);
+            fprintf(stderr, "%s\n", sv_str(entity->displayName));
             PangoAttrList *attrs = pango_attr_list_copy(fontAttrs);
             pango_attr_list_insert(attrs, pango_attr_foreground_new(255, 50, 50));
             gtk_label_set_attributes(GTK_LABEL(label), fontAttrs);
@@ -450,17 +810,17 @@ void render_gopher_entity_to_gtk(GtkBox *box, gopherEntity *entity)
         case GOPHER_ENTITY_MAC_BINHEX:
         case GOPHER_ENTITY_PC_DOS_FILE:
         {
-            GtkWidget *button = gb_gtk_ext_icon_label_button("binary", entity->displayName.contents);
+            GtkWidget *button = gb_gtk_ext_icon_label_button("binary", sv_str(entity->displayName));
             SET_DEFAULT_ALIGNMENT(button);
             gtk_box_append(box, button);
-            g_signal_connect(button, "clicked", G_CALLBACK(handle_gopher_bin), entity);
+            connect_entity_link(button, G_CALLBACK(handle_gopher_bin), entity, compact, index);
             break;
         }
         case GOPHER_ENTITY_INDEX_SERVER:
         {
             GtkWidget *localBox = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 6);
-            //GtkWidget *button = gb_gtk_ext_icon_label_button("search", entity->displayName.contents);
-            GtkWidget *label = gtk_label_new(entity->displayName.contents);
+            //GtkWidget *button = gb_gtk_ext_icon_label_button("search", sv_str(entity->displayName));
+            GtkWidget *label = gtk_label_new(sv_str(entity->displayName));
             gtk_label_set_attributes(GTK_LABEL(label), fontAttrs);
             SET_DEFAULT_ALIGNMENT(label);
             SET_MARGINS(label, 10, 10, 0, 0);
@@ -478,7 +838,7 @@ void render_gopher_entity_to_gtk(GtkBox *box, gopherEntity *entity)
             struct gopherSearchData searchData;
             searchData.entity = *entity;
             searchData.searchEntry = GTK_ENTRY(entry);
-            void *callbackData = tm_add(&pageTempMem, &searchData, sizeof(struct gopherSearchData));
+            void *callbackData = ma_add(pageArena, &searchData, sizeof(struct gopherSearchData));
             g_signal_connect(button, "clicked", G_CALLBACK(handle_gopher_page), callbackData);
             g_signal_connect(entry, "activate", G_CALLBACK(handle_gopher_page), callbackData);
             gtk_box_append(box, localBox);
@@ -489,44 +849,14 @@ void render_gopher_entity_to_gtk(GtkBox *box, gopherEntity *entity)
         case GOPHER_P_ENTITY_BMP:
         case GOPHER_ENTITY_GIF:
         {
-            fprintf(stderr, "Loading image %s\n", entity->selector.contents);
-            resizableBuffer imageBuf = entity->prefetchedData;
-            if (imageBuf.count == 0)
+            fprintf(stderr, "Loading image %s\n", sv_str(entity->selector));
+            //Not fetched yet; the caller fills the box in once it is
+            if (entity->prefetchedData == nullptr)
             {
-                GtkWidget *label = gtk_label_new("Image failed to load.");
-                gtk_label_set_attributes(GTK_LABEL(label), fontAttrs);
-                gtk_box_append(box, label);
+                gtk_box_append(box, gtk_box_new(GTK_ORIENTATION_VERTICAL, 0));
                 break;
             }
-            /*FILE *rawImg = fopen("rawimage.bin", "wb");
-            fwrite(imageBuf.contents, 1, imageBuf.count, rawImg);
-            fclose(rawImg);*/
-            int x, y, imgChannels;
-            stbi_uc *image = stbi_load_from_memory(imageBuf.contents, (int)imageBuf.count, &x, &y, &imgChannels, 4);
-
-            //Write image as BMP for debugging
-            /*FILE *img = fopen("image.bmp", "wb");
-            fwrite(image, x * y * imgChannels, 1, img);
-            fclose(img);*/
-
-            //GdkTexture *texture = gdk_memory_texture_new(x, y, GDK_MEMORY_R8G8B8A8, (GBytes *) image, x * 4);
-            GError *error = nullptr;
-            GBytes *imgBytes = g_bytes_new(imageBuf.contents, imageBuf.count);
-            GdkTexture *texture = gdk_texture_new_from_bytes(imgBytes, &error);
-            if (error != nullptr)
-            {
-                fprintf(stderr, "A GDK error occurred when loading %s: %s", entity->selector.contents, error->message);
-                GtkWidget *label = gtk_label_new("Image failed to load.");
-                gtk_label_set_attributes(GTK_LABEL(label), fontAttrs);
-                gtk_box_append(box, label);
-                break;
-            }
-            GtkWidget *picture = gtk_picture_new();
-            gtk_picture_set_paintable(GTK_PICTURE(picture), GDK_PAINTABLE(texture));
-            gtk_picture_set_content_fit(GTK_PICTURE(picture), GTK_CONTENT_FIT_CONTAIN);
-            SET_MARGINS(picture, 10, 10, 0, 10);
-            gtk_widget_set_halign(picture, GTK_ALIGN_START);
-            gtk_box_append(box, picture);
+            append_image_to_gtk(box, entity->prefetchedData->buffer, sv_str(entity->selector));
             break;
         }
         case GOPHER_ENTITY_UUENCODED_FILE:
@@ -547,4 +877,46 @@ void render_gopher_entity_to_gtk(GtkBox *box, gopherEntity *entity)
         case GOPHER_NS_ENTITY_XML:
             fprintf(stderr, "This client does not support Gopher entities of type %s(%c)\n", get_string_gopher_type(entity->type), entity->type);
     }
+}
+
+/*
+ Parses a large menu and renders it from a compactMenu kept in the page's arena, which is stored through compactOutput.
+ Returns a menu of just the images, whose entities are views into the compactMenu, for the prefetch to fill in.
+ */
+static gopherMenu render_compact_menu(GtkBox *box, resizableBuffer *source, const compactMenu **compactOutput)
+{
+    gopherMenu parsed = parse_gopher_menu_from_buffer(source);
+    compactMenu built = cm_from_menu(&parsed);
+    gopher_menu_free(&parsed); //The response and the entities go back now, so only the compact copy stays around
+    const compactMenu *compact = cm_move_to_arena(&built, pageArena);
+    *compactOutput = compact;
+    if (compact == nullptr)
+    {
+        fprintf(stderr, "Not enough memory to show the menu\n");
+        return (gopherMenu) { .entities = nullptr, .numEntities = 0, .freed = false, .prefetch = nullptr,
+                              .source = RB_EMPTY, .arena = pageArena };
+    }
+
+    size_t numImages = 0;
+    for (size_t i = 0; i < compact->numEntities; i++)
+    {
+        if (gopher_entity_needs_prefetch(cm_type(compact, i))) numImages++;
+    }
+    gopherMenu images = { .entities = ma_calloc(pageArena, numImages, sizeof(gopherEntity)), .numEntities = numImages,
+                          .freed = false, .prefetch = nullptr, .source = RB_EMPTY, .arena = pageArena };
+    pageImageHolders = ma_calloc(pageArena, numImages, sizeof(GtkWidget *));
+    numPageImageHolders = numImages;
+    for (size_t i = 0, image = 0; i < compact->numEntities; i++)
+    {
+        gopherEntity entity = cm_get_entity(compact, i);
+        if (!gopher_entity_needs_prefetch(entity.type))
+        {
+            render_entity(box, &entity, compact, i);
+            continue;
+        }
+        images.entities[image] = entity;
+        render_entity(box, &images.entities[image], nullptr, 0);
+        pageImageHolders[image++] = g_object_ref(gtk_widget_get_last_child(GTK_WIDGET(box)));
+    }
+    return images;
 }
\ No newline at end of file